@@ -1,63 +1,805 @@
 // Written by Robert Parton
 // 17 November 2022
 
+#define _GNU_SOURCE
+
 #include <assert.h>
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <math.h>
+#include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#define HAVE_IO_URING 1
+#endif
+#if __has_include(<linux/perf_event.h>)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#define HAVE_PERF_EVENTS 1
+#endif
+#endif
+
+#ifdef USE_MPI
+#include <mpi.h>
+#endif
 
-#include "Graph.h"
 #include "List.h"
 
-#define MAX_STRLEN 100
-
-List readCollectionFile();
-Graph createGraph(List l);
-static void insertEdges(Graph g, List l, FILE *fp, char *url, Node curr);
-static int getUrlIndex(List l, char *url);
-List calculatePageRank(List l, Graph g, double d, double diffPR, 
-                        int maxIterations);
-static double getPageWeight(List l, Graph g, Graph gWin, Graph gWout, Node pi);
-static void initialiseRankAndDegree(List l, Graph g, double N);
-static double calculateDiff(List l);
-static Graph setGraphWin(List l, Graph g);
-static Graph setGraphWout(List l, Graph g);
-static double calculateWin(List l, Graph g, Node pj, Node pi);
-static double incomingDegree(Graph g, int urlA);
-static double calculateWout(List l, Graph g, Node pj, Node pi);
-static double outgoingDegree(Graph g, int urlA);
-static bool isAdjacent(Graph g, int v, int w);
-static Node getNode(List l, int index);
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define LARGE_CACHE_SLOTS 32
+#define BATCH_OUTPUT_FILE "pageRankList.txt"
+#define URING_QUEUE_DEPTH 64
+#define URING_READ_SIZE (16 * 1024)
+#define URING_FALLBACK_THREADS 4
+#define ARCHIVE_MAGIC "PRPACK1"
+#define ARCHIVE_READ_SIZE (4 * 1024 * 1024)
+#define URL_TABLE_MAGIC "PRMPHF1"
+#define URL_BUCKET_SIZE 4
+#define URL_PILOT_LIMIT (1 << 24)
+#define URL_FINGERPRINT_SEED 0x50524d5048460001ULL
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#define LARGE_HEADER_SIZE 64
+#define PREFETCH_AUTO -1
+#define PREFETCH_MAX_DISTANCE 256
+#define PREFETCH_SAMPLE_EDGES (1 << 18)
+#define PREFETCH_SAMPLE_RUNS 5
+#define PREFETCH_MIN_GAIN 0.9
+#define DELTA_MAX_BYTES 9
+#define PAGE_NONE UINT32_MAX
+#define GMRES_RESTART 16
+#define BICGSTAB_BREAKDOWN 1e-14
+#define CHEBYSHEV_WARMUP 3
+#define SELL_CHUNK 8
+#define SELL_SIGMA 512
+#define DEGREE_BUCKETS 7
+#define BUCKET_LARGE_MIN 256
+#define TILE_SIZE 64
+#define TILE_MIN_LINKS 1024
+
+// Bump allocator for per-job scratch memory. Blocks are kept on reset so
+// consecutive batch jobs reuse the same memory instead of calling malloc.
+typedef struct arenaBlock {
+    struct arenaBlock *next;
+    size_t size;
+    size_t used;
+    _Alignas(16) char data[];
+} ArenaBlock;
+
+typedef struct {
+    ArenaBlock *head;
+    ArenaBlock *curr;
+} Arena;
+
+// Pages are numbered by their index in the collection. Edge offsets are 64 
+// bit unless the build only needs to handle graphs under 4G edges.
+typedef uint32_t PageId;
+#ifdef EDGE_INDEX_32
+typedef uint32_t EdgeIndex;
+#define MAX_EDGES UINT32_MAX
+#else
+typedef uint64_t EdgeIndex;
+#define MAX_EDGES UINT64_MAX
+#endif
+
+// A link from page v to page w
+typedef struct {
+    PageId v;
+    PageId w;
+} Edge;
+
+// Links found while parsing, which may contain duplicates
+typedef struct {
+    Edge *edges;
+    size_t nE;
+    size_t capacity;
+} EdgeList;
+
+// Compact in-link graph used by the rank iteration. The pages linking to 
+// page i are inSrc[inStart[i]] .. inSrc[inStart[i + 1] - 1] in increasing 
+// order, without duplicates or self loops. inSrc is followed by 
+// PREFETCH_MAX_DISTANCE zero entries so the iteration can prefetch past 
+// the last edge.
+typedef struct rankGraph {
+    PageId nV;
+    EdgeIndex nE;
+    EdgeIndex *inStart;
+    PageId *inSrc;
+    uint32_t *inDegree;
+    uint32_t *outDegree;
+} *RankGraph;
+
+// Where the graph and rank arrays get their memory from
+typedef enum {
+    HUGEPAGES_OFF,
+    HUGEPAGES_THP,
+    HUGEPAGES_HUGETLB,
+} HugePageMode;
+
+// Hardware events that --stats can count
+typedef enum {
+    COUNT_DTLB_MISSES,
+    COUNT_L1D_MISSES,
+    COUNT_LLC_MISSES,
+} PerfCounter;
+
+// Stored in front of every allocLarge block so it can be freed, or kept 
+// for reuse by a later allocLarge of up to capacity bytes
+typedef struct {
+    size_t mapSize;
+    size_t capacity;
+} LargeHeader;
+
+// Blocks freed by freeLarge on a batch worker, kept for the next job's 
+// arrays. Collections in a batch tend to have similar sizes, so after the 
+// first job most graph, rank, edge and url table arrays fit a kept block.
+typedef struct {
+    char *blocks[LARGE_CACHE_SLOTS];
+    int nBlocks;
+} LargeCache;
+
+// How the ranks are solved for
+typedef enum {
+    SOLVER_POWER,
+    SOLVER_SCC,
+    SOLVER_BICGSTAB,
+    SOLVER_GMRES,
+    SOLVER_CHEBYSHEV,
+} RankSolver;
+
+// Which PageRank formula the ranks follow
+typedef enum {
+    MODE_WEIGHTED,
+    MODE_CLASSIC,
+} RankMode;
+
+// How the in-links are laid out for the power iteration
+typedef enum {
+    LAYOUT_CSR,
+    LAYOUT_SELL,
+#ifdef USE_DEGREE_BUCKETS
+    LAYOUT_BUCKETS,
+#endif
+    LAYOUT_TILES,
+} RankLayout;
+
+// How the power iteration uses the host-level graph
+typedef enum {
+    HOSTS_OFF,
+    HOSTS_SEED,
+    HOSTS_TWOLEVEL,
+} HostMode;
+
+// Settings for the rank iteration
+typedef struct {
+    double d;
+    double diffPR;
+    int maxIterations;
+    RankMode mode;
+    bool computedCoef;
+    RankLayout layout;
+    int prefetch;
+    bool async;
+    double compress;
+    int procs;
+    RankSolver solver;
+    bool prune;
+    HostMode hosts;
+    bool stats;
+} RankConfig;
+
+// The pages grouped by host (the url up to its first '.') and the links 
+// between hosts, as a CSR of in-links. linkOf maps each page in-link to 
+// the host link it is part of, so the host link weights can be summed from 
+// the page ranks in one pass.
+typedef struct {
+    uint32_t nHosts;
+    uint32_t *hostOf;
+    uint32_t *hostSize;
+    EdgeIndex nLinks;
+    EdgeIndex *inStart;
+    uint32_t *inSrc;
+    EdgeIndex *linkOf;
+    double *weight;
+    double *mass;
+    double *hostRank;
+    double *hostPrev;
+} HostGraph;
+
+// The in-links in sliced ELLPACK (SELL-C-sigma) form. Pages are sorted by 
+// in-degree within windows of SELL_SIGMA and cut into chunks of SELL_CHUNK, 
+// and each chunk stores its in-links column by column, padded with zero 
+// coefficients to its longest page. Entry j of lane k of chunk c is at 
+// chunkStart[c] + j * SELL_CHUNK + k. page holds the page in each lane, 
+// or PAGE_NONE in the lanes past the last page.
+typedef struct {
+    PageId nChunks;
+    PageId *page;
+    EdgeIndex *chunkStart;
+    PageId *src;
+    double *coef;
+} SellMatrix;
+
+#ifdef USE_DEGREE_BUCKETS
+// Pages grouped by in-degree for the bucketed kernels: one bucket for each 
+// in-degree from 0 to 4, then 5 to BUCKET_LARGE_MIN - 1, then the rest. 
+// Bucket b holds pages[start[b]] .. pages[start[b + 1] - 1] in page order. 
+// seconds adds up the time spent in each bucket when it is timed.
+typedef struct {
+    PageId *pages;
+    PageId start[DEGREE_BUCKETS + 1];
+    EdgeIndex links[DEGREE_BUCKETS];
+    double seconds[DEGREE_BUCKETS];
+} DegreeBuckets;
+#endif
+
+// The in-links split into dense tiles and a sparse rest. The pages are cut 
+// into blocks of TILE_SIZE, and the links from one block into another form 
+// a tile. A tile with at least TILE_MIN_LINKS links is kept as a bitmap: 
+// word r of the tile has bit c set when source page col + c links to page 
+// row + r. Tiles are in order of their row block, and row block k's tiles 
+// are tileStart[k] .. tileStart[k + 1] - 1. The other links stay in sparse.
+typedef struct {
+    PageId nBlocks;
+    PageId nTiles;
+    PageId *tileStart;
+    PageId *tileCol;
+    uint64_t *bits;
+    struct rankGraph sparse;
+} TiledGraph;
+
+// A page and its in-degree, for sorting pages by degree
+typedef struct {
+    uint32_t degree;
+    PageId page;
+} DegreeKey;
+
+// Start of the shared memory segment used by --procs. The per worker diffs 
+// and timings, both rank buffers and then the graph follow it. The graph 
+// starts on a page boundary so the workers can make it read-only.
+typedef struct {
+    pthread_barrier_t barrier;
+    int latest;
+    int iterations;
+    double diff;
+} SharedHeader;
+
+// The loader's and each worker's view of the segment
+typedef struct {
+    SharedHeader *header;
+    void *base;
+    size_t size;
+    size_t graphOffset;
+    int nProcs;
+    PageId *bounds;
+    double *diffs;
+    double *seconds;
+    double *rank[2];
+    struct rankGraph graph;
+    double *coef;
+} SharedRanks;
+
+#ifdef USE_MPI
+// One process's share of the graph in distributed mode. The process owns 
+// pages first .. last - 1 and keeps their in-links in local, which numbers 
+// its columns with the owned pages first and then a ghost copy of every 
+// page on another process that links to them. Ghosts are in page order, 
+// which groups them by owner, so each iteration's exchange is a single 
+// all-to-all: sendCol lists the owned columns each process wants, and the 
+// replies land straight in the ghost columns.
+typedef struct {
+    PageId first;
+    PageId last;
+    PageId nGhosts;
+    struct rankGraph local;
+    double *coef;
+    PageId *ghostPage;
+    int *recvCounts;
+    int *recvDispls;
+    PageId *sendCol;
+    int *sendCounts;
+    int *sendDispls;
+    int nSend;
+} Partition;
+
+// Encodes the ranks sent to each neighbour. Without a threshold they go as 
+// raw doubles. With --compress only ranks that moved by more than the 
+// threshold since they were last sent go, each as a varint gap from the 
+// previous index sent and the change as a float. sentValue holds what the 
+// receiver has reconstructed, so the float's rounding is carried into the 
+// next change instead of accumulating.
+typedef struct {
+    double threshold;
+    double *sentValue;
+    unsigned char *sendBytes;
+    unsigned char *recvBytes;
+    int *sendLens;
+    int *recvLens;
+    int *sendOffsets;
+    int *recvOffsets;
+    long long offered;
+    long long values;
+} GhostCodec;
+
+// Per process counters for --stats in distributed mode. bytes has an entry 
+// per synchronous iteration and grows as the iterations run.
+typedef struct {
+    int sweeps;
+    double computeSeconds;
+    double exchangeSeconds;
+    long long messages;
+    long long skipped;
+    long long totalBytes;
+    long long *bytes;
+    int bytesCapacity;
+} MpiStats;
+#endif
+
+// How the page files are read
+typedef enum {
+    INGEST_SYNC,
+    INGEST_THREADS,
+    INGEST_URING,
+} IngestMode;
+
+// Where a collection's input files are read from. collectionFile and pageDir 
+// are relative to root unless they are absolute paths.
+typedef struct {
+    const char *root;
+    const char *collectionFile;
+    const char *pageDir;
+    const char *archive;
+    const char *urlTable;
+    IngestMode mode;
+    int ingestThreads;
+    int queueDepth;
+    int resolveThreads;
+    bool stats;
+} InputConfig;
+
+// Throughput of loading the page files, reported with --stats
+typedef struct {
+    int files;
+    size_t bytes;
+    double seconds;
+    const char *engine;
+    int maxDepth;
+    double totalDepth;
+    int depthSamples;
+    double parseSeconds;
+} IngestStats;
+
+// Minimal perfect hash (CHD style) from url to page index. Each url hashes to 
+// a bucket whose pilot value picks the url's slot, so a lookup is one hash 
+// and one compare against the only url that can be in that slot.
+typedef struct {
+    uint64_t seed;
+    uint32_t nPages;
+    uint32_t nSlots;
+    uint32_t nBuckets;
+    uint32_t *pilots;
+    uint32_t *slotPage;
+    const char **urls;
+    uint32_t *urlLens;
+} UrlTable;
+
+// A url's hash while the perfect hash is built
+typedef struct {
+    uint64_t hash;
+    uint32_t page;
+} UrlKey;
+
+// An outlink token waiting for the hash join, with its hash computed once 
+// while parsing. The token's bytes are at offset in the outlink pool.
+typedef struct {
+    uint64_t hash;
+    uint64_t offset;
+    uint32_t len;
+    uint32_t source;
+} Outlink;
+
+// Outlinks collected while parsing when they are resolved on several threads
+typedef struct {
+    Outlink *links;
+    size_t nLinks;
+    size_t capacity;
+    char *pool;
+    size_t poolLen;
+    size_t poolCapacity;
+} OutlinkBuffer;
+
+// State shared by the page loaders while the graph is built
+typedef struct {
+    List l;
+    EdgeList links;
+    UrlTable urls;
+    IngestStats stats;
+    int resolveThreads;
+    OutlinkBuffer pending;
+} Ingest;
+
+// Shared state for the hash join threads. Outlinks are partitioned by the 
+// top bits of their hash, so each partition only touches its own range of 
+// url table buckets.
+typedef struct {
+    const UrlTable *urls;
+    const Outlink *links;
+    const char *pool;
+    const size_t *partStart;
+    int nParts;
+    int next;
+    int32_t *targets;
+    pthread_mutex_t lock;
+} JoinQueue;
+
+// Walks the whitespace separated tokens of a collection or page file that 
+// has been read into memory. Tokens point into the file's buffer.
+typedef struct {
+    const unsigned char *pos;
+    const unsigned char *end;
+} Tokenizer;
+
+// Settings parsed from the command line
+typedef struct {
+    RankConfig rank;
+    HugePageMode hugePages;
+    const char *manifest;
+    int batchThreads;
+    const char *pack;
+    InputConfig input;
+} Options;
+
+// A collection archive holds the collection file and every page file so they 
+// can be read with a few large sequential reads. It is laid out as
+//   header | collection file | page files in collection order | index
+// where each index entry is a uint64 offset, uint64 length, uint32 url length 
+// and the url's bytes, in the same order as the page files.
+typedef struct {
+    char magic[8];
+    uint32_t nPages;
+    uint32_t reserved;
+    uint64_t collectionOffset;
+    uint64_t collectionLength;
+    uint64_t indexOffset;
+    uint64_t indexLength;
+} ArchiveHeader;
+
+// Shared state for the batch mode worker threads
+typedef struct {
+    char **dirs;
+    int nDirs;
+    int next;
+    int failed;
+    pthread_mutex_t lock;
+    const Options *opt;
+} BatchQueue;
+
+// A page file read into memory
+typedef struct {
+    char *data;
+    size_t len;
+} PageFile;
+
+// Shared state for the threads loading page files. Loaders append the index 
+// of each file they finish to done so it can be parsed straight away.
+typedef struct {
+    Node *pages;
+    int nPages;
+    int pageDirFd;
+    int next;
+    PageFile *files;
+    int *done;
+    int nDone;
+    bool failed;
+    pthread_mutex_t lock;
+    pthread_cond_t loaded;
+} IngestQueue;
+
+static bool parseOptions(int argc, char *argv[], Options *opt);
+List readCollectionFile(const InputConfig *in, Arena *a);
+RankGraph createGraph(List l, const InputConfig *in, Arena *a);
+static void addEdge(EdgeList *links, PageId v, PageId w);
+static RankGraph buildRankGraph(EdgeList *links, PageId nV);
+static void freeRankGraph(RankGraph g);
+static bool insertPagesParallel(Ingest *ing, int dirFd, int nThreads, 
+                                Arena *a);
+static void *loadWorker(void *arg);
+static int insertPagesUring(Ingest *ing, int dirFd, int queueDepth, Arena *a);
+static bool readPageFile(int dirFd, const char *url, PageFile *pf);
+static bool readFileAt(int dirFd, const char *filename, PageFile *pf);
+static bool insertPagesArchive(Ingest *ing, const char *path);
+static char *readArchiveCollection(const char *path, size_t *len);
+static int openArchive(const char *path, ArchiveHeader *h);
+static bool preadFull(int fd, void *buf, size_t len, uint64_t offset);
+static int packCollection(const InputConfig *in, const char *packPath);
+static void insertEdges(Ingest *ing, const PageFile *pf, Node curr);
+static void tokenizerInit(Tokenizer *t, const char *data, size_t len, 
+                          bool skipFirstLine);
+static bool nextToken(Tokenizer *t, const char **token, size_t *len);
+static void deferOutlink(Ingest *ing, const char *url, size_t len, 
+                         uint64_t hash, int source);
+static void resolveOutlinks(Ingest *ing, bool stats);
+static void *joinWorker(void *arg);
+static int getUrlIndex(const UrlTable *t, const char *url, size_t len);
+static int findUrl(const UrlTable *t, const char *url, size_t len, 
+                   uint64_t h);
+static bool buildUrlTable(UrlTable *t, List l, const char *path, 
+                          bool stats);
+static bool buildPerfectHash(UrlTable *t, uint64_t seed);
+static bool loadUrlTable(UrlTable *t, const char *path, uint64_t fingerprint);
+static void saveUrlTable(const UrlTable *t, const char *path, 
+                         uint64_t fingerprint);
+static void freeUrlTable(UrlTable *t);
+static uint64_t hashUrl(const char *url, size_t len, uint64_t seed);
+static uint64_t mix64(uint64_t x);
+static int compareKeys(const void *a, const void *b);
+List calculatePageRank(List l, RankGraph g, const RankConfig *rc);
+static void updateRanks(RankGraph g, const double *coef, 
+                        const double *prevRank, double *rank, PageId first, 
+                        PageId last, double d, double N, int distance);
+static double getPageWeight(RankGraph g, const double *coef, 
+                            const double *prevRank, PageId pi);
+static double getPageWeightPrefetch(RankGraph g, const double *coef, 
+                                    const double *prevRank, PageId pi, 
+                                    int distance);
+static int tunePrefetchDistance(RankGraph g, const double *coef, 
+                                const double *prevRank, double *rank, 
+                                double d, double N, bool stats);
+static void initialiseRank(double *rank, PageId nV, double N);
+static double calculateDiff(const double *rank, const double *prevRank, 
+                            PageId nV);
+static double *setEdgeCoefficients(RankGraph g, PageId first, PageId last);
+static void fillEdgeCoefficients(RankGraph g, PageId first, PageId last, 
+                                 double *coef);
+static double calculateWin(RankGraph g, const double *inTotal, PageId pj, 
+                           PageId pi);
+static double calculateWout(RankGraph g, const double *outTotal, PageId pj, 
+                            PageId pi);
+static double adjustedOutDegree(RankGraph g, PageId p);
+static double solveComponents(RankGraph g, const double *coef, double *rank, 
+                              double *next, const RankConfig *rc, 
+                              int *iterations);
+static PageId findComponents(RankGraph g, PageId *order, PageId *compStart, 
+                             PageId *compOf);
+static double solvePruned(RankGraph g, const double *coef, double *rank, 
+                          const RankConfig *rc, int distance, 
+                          int *iterations);
+static double solveBicgstab(RankGraph g, const double *coef, double *rank, 
+                            const RankConfig *rc, int distance, 
+                            int *iterations);
+static double solveGmres(RankGraph g, const double *coef, double *rank, 
+                         const RankConfig *rc, int distance, int *iterations);
+static void applyOperator(RankGraph g, const double *coef, const double *x, 
+                          double *y, double d, int distance);
+static double getResidual(RankGraph g, const double *coef, const double *x, 
+                          double *r, double d, int distance);
+static double dotProduct(const double *x, const double *y, PageId n);
+static bool breaksDown(double dot, double scale);
+static double solveChebyshev(RankGraph g, const double *coef, double **rank, 
+                             double **prevRank, const RankConfig *rc, 
+                             int distance, int *iterations);
+static double solveFactored(RankGraph g, const double *pageScale, 
+                            const double *sourceScale, double **rank, 
+                            double **prevRank, const RankConfig *rc, 
+                            int distance, int *iterations);
+static void setCoefficientFactors(RankGraph g, RankMode mode, 
+                                  double *pageScale, double *sourceScale);
+static double solveWithHosts(List l, RankGraph g, const double *coef, 
+                             double **rank, double **prevRank, 
+                             const RankConfig *rc, int distance, 
+                             int *iterations);
+static bool urlsHaveHosts(List l);
+static const char *urlHost(const char *url, size_t *len);
+static void buildHostGraph(List l, RankGraph g, HostGraph *hg);
+static int seedLocalRanks(RankGraph g, const double *coef, HostGraph *hg, 
+                          double **rank, double **prevRank, 
+                          const RankConfig *rc, int distance, int maxSweeps, 
+                          EdgeIndex *localLinks);
+static int correctWithHosts(RankGraph g, const double *coef, HostGraph *hg, 
+                            double *rank, const RankConfig *rc);
+static void freeHostGraph(HostGraph *hg);
+static double solveSell(RankGraph g, const double *coef, double **rank, 
+                        double **prevRank, const RankConfig *rc, 
+                        int *iterations);
+static void buildSellMatrix(RankGraph g, const double *coef, SellMatrix *m);
+static void updateRanksSell(const SellMatrix *m, const double *prevRank, 
+                            double *rank, double d, double N);
+static int compareDegreeKeys(const void *a, const void *b);
+#ifdef USE_DEGREE_BUCKETS
+static double solveBuckets(RankGraph g, const double *coef, double **rank, 
+                           double **prevRank, const RankConfig *rc, 
+                           int *iterations);
+static void buildDegreeBuckets(RankGraph g, DegreeBuckets *b);
+static void updateRanksBuckets(RankGraph g, const double *coef, 
+                               const double *prevRank, double *rank, 
+                               DegreeBuckets *b, double d, double N, 
+                               bool timed);
+static double getPageWeightSplit(RankGraph g, const double *coef, 
+                                 const double *prevRank, PageId pi);
+#endif
+static double solveTiled(RankGraph g, const double *pageScale, 
+                         const double *sourceScale, double **rank, 
+                         double **prevRank, const RankConfig *rc, 
+                         int distance, int *iterations);
+static void buildTiledGraph(RankGraph g, TiledGraph *t);
+static void freeTiledGraph(TiledGraph *t);
+static void printMemoryUsage(RankGraph g, size_t coefBytes, 
+                             size_t extraPageBytes);
+static PageId *partitionPages(RankGraph g, int nProcs);
+static List calculatePageRankShared(List l, RankGraph g, 
+                                    const RankConfig *rc);
+static void createSharedRanks(SharedRanks *s, RankGraph g, int nProcs);
+static void sharedWorker(SharedRanks *s, int w, const RankConfig *rc, 
+                         int distance);
+#ifdef USE_MPI
+static List calculatePageRankMpi(List l, RankGraph g, const RankConfig *rc);
+static Partition *buildPartition(RankGraph g, const PageId *bounds);
+static void exchangeGhosts(const Partition *part, GhostCodec *codec, 
+                           double *rank, double *prevRank, MpiStats *ms);
+static double iterateAsync(const Partition *part, GhostCodec *codec, 
+                           double **rank, double **prevRank, 
+                           const RankConfig *rc, double N, int distance, 
+                           MpiStats *ms);
+static void initGhostCodec(GhostCodec *codec, const Partition *part, 
+                           double threshold, double N);
+static int encodeGhosts(GhostCodec *codec, const Partition *part, int q, 
+                        const double *rank);
+static void decodeGhosts(const GhostCodec *codec, const Partition *part, 
+                         int q, int len, double *rank, double *prevRank);
+static void freeGhostCodec(GhostCodec *codec);
+static void freePartition(Partition *part);
+#endif
+static void *allocArray(size_t n, size_t size);
+static void *allocLarge(size_t n, size_t size);
+static void *growLarge(void *p, size_t n, size_t size);
+static char *takeCachedBlock(size_t bytes, bool largest);
+static void freeLarge(void *p);
+static void releaseLargeCache(LargeCache *c);
+static void releaseLargeBlock(char *base);
+static int perfOpen(PerfCounter counter);
+static long long perfRead(int fd);
+static void writeRanks(FILE *out, List l);
+static int runBatch(const Options *opt);
+static void *batchWorker(void *arg);
+static bool rankCollection(const Options *opt, const char *root, Arena *a);
+static void printLabelledStats(const char *label, const char *buf, 
+                               size_t len);
+static FILE *statsStream(void);
+static char *joinPath(Arena *a, const char *dir, const char *name, 
+                      const char *ext);
+static char *inputPath(Arena *a, const char *root, const char *name);
+static int run(int argc, char *argv[]);
+static void *arenaAlloc(Arena *a, size_t size);
+static void arenaReset(Arena *a);
+static void arenaFree(Arena *a);
+static double now(void);
+
+// Set once from the command line before any graph is built
+static HugePageMode largeAllocMode = HUGEPAGES_OFF;
+
+// Where --stats lines go on this thread; batch jobs buffer their own lines so 
+// they can be labelled with the collection, everyone else writes to stderr
+static __thread FILE *statsFile = NULL;
+
+// Set on batch workers so allocLarge and freeLarge reuse blocks across jobs
+static __thread LargeCache *largeCache = NULL;
+
+#ifdef USE_MPI
+// This process's place in MPI_COMM_WORLD
+static int mpiRank = 0;
+static int mpiSize = 1;
+#endif
 
 int main(int argc, char *argv[]) {
-    if (argc != 4) {
-        fprintf(stderr, "Usage: %s dampingFactor diffPR maxIterations\n",
-                argv[0]);
+#ifdef USE_MPI
+    MPI_Init(&argc, &argv);
+    MPI_Comm_rank(MPI_COMM_WORLD, &mpiRank);
+    MPI_Comm_size(MPI_COMM_WORLD, &mpiSize);
+    int status = run(argc, argv);
+    if (status != 0 && mpiSize > 1) {
+        // Stop the other processes rather than leave them in a collective
+        MPI_Abort(MPI_COMM_WORLD, status);
+    }
+    MPI_Finalize();
+    return status;
+#else
+    return run(argc, argv);
+#endif
+}
+
+// Ranks the collection described by the command line
+static int run(int argc, char *argv[]) {
+    Options opt;
+    if (!parseOptions(argc, argv, &opt)) {
+        fprintf(stderr, "Usage: %s dampingFactor diffPR maxIterations "
+                "[options]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    largeAllocMode = opt.hugePages;
+
+#ifdef USE_MPI
+    // Every process loads the whole graph, then iterates on its partition. 
+    // Only the first one reports and prints.
+    if (mpiSize > 1 && (opt.manifest != NULL || opt.pack != NULL)) {
+        if (mpiRank == 0) {
+            fprintf(stderr, "error: --batch and --pack run in a single "
+                    "process\n");
+        }
+        return EXIT_FAILURE;
+    }
+    if (mpiSize > 1 && (opt.rank.solver != SOLVER_POWER || opt.rank.prune 
+                        || opt.rank.hosts != HOSTS_OFF 
+                        || opt.rank.mode != MODE_WEIGHTED 
+                        || opt.rank.computedCoef 
+                        || opt.rank.layout != LAYOUT_CSR)) {
+        if (mpiRank == 0) {
+            fprintf(stderr, "error: MPI runs only use the power solver\n");
+        }
         return EXIT_FAILURE;
     }
+    if (mpiRank != 0) {
+        opt.input.stats = false;
+        opt.rank.stats = false;
+    }
+#endif
+
+    // Rank every collection listed in the manifest instead of the root
+    if (opt.manifest != NULL) {
+        return runBatch(&opt);
+    }
+
+    // Pack the collection into an archive instead of ranking it
+    if (opt.pack != NULL) {
+        return packCollection(&opt.input, opt.pack);
+    }
 
-    // Convert inputs from strings to integers
-    double d = atof(argv[1]);
-    double diffPR = atof(argv[2]);
-    int maxIterations = atoi(argv[3]);
+    Arena scratch = {NULL, NULL};
 
     // Read URLs and store in a Linked List
-    List urlList = readCollectionFile();
+    List urlList = readCollectionFile(&opt.input, &scratch);
+    if (urlList == NULL) {
+        arenaFree(&scratch);
+        return EXIT_FAILURE;
+    }
 
-    // Create Graph Matrix for urlList
-    Graph urlGraph = createGraph(urlList);
+    // Create the in-link graph for urlList
+    RankGraph urlGraph = createGraph(urlList, &opt.input, &scratch);
+    arenaFree(&scratch);
+    if (urlGraph == NULL) {
+        ListFree(urlList);
+        return EXIT_FAILURE;
+    }
 
     // Calculate the page ranks for each url
-    urlList = calculatePageRank(urlList, urlGraph, d, diffPR, maxIterations);
+    urlList = calculatePageRank(urlList, urlGraph, &opt.rank);
+#ifdef USE_MPI
+    if (mpiRank != 0) {
+        ListFree(urlList);
+        freeRankGraph(urlGraph);
+        return 0;
+    }
+#endif
     ListSort(urlList);
 
     ListPrint(urlList);
 
     ListFree(urlList);
-    GraphFree(urlGraph);
+    freeRankGraph(urlGraph);
     return 0;
 }
 
@@ -65,30 +807,273 @@ int main(int argc, char *argv[]) {
 // Helper Functions
 //
 
-// Reads the collection.txt file and creates a Linked List containing the URLs
-List readCollectionFile() {
-    List urlList = ListNew();
-    FILE *fp = fopen("collection.txt", "r");
-    if (fp == NULL) {
-        fprintf(stderr, "fopen\n");
-        exit(EXIT_FAILURE);
+// Fills opt from the command line. Returns false if the arguments are invalid.
+static bool parseOptions(int argc, char *argv[], Options *opt) {
+    if (argc < 4) return false;
+
+    // Convert inputs from strings to numbers
+    opt->rank.d = atof(argv[1]);
+    opt->rank.diffPR = atof(argv[2]);
+    opt->rank.maxIterations = atoi(argv[3]);
+    opt->rank.mode = MODE_WEIGHTED;
+    opt->rank.computedCoef = false;
+    opt->rank.layout = LAYOUT_CSR;
+    opt->rank.prefetch = PREFETCH_AUTO;
+    opt->rank.async = false;
+    opt->rank.compress = -1;
+    opt->rank.procs = 1;
+    opt->rank.solver = SOLVER_POWER;
+    opt->rank.prune = false;
+    opt->rank.hosts = HOSTS_OFF;
+    opt->rank.stats = false;
+    opt->hugePages = HUGEPAGES_OFF;
+    opt->manifest = NULL;
+    opt->batchThreads = 1;
+    opt->pack = NULL;
+    opt->input.root = ".";
+    opt->input.collectionFile = "collection.txt";
+    opt->input.pageDir = ".";
+    opt->input.archive = NULL;
+    opt->input.urlTable = NULL;
+    opt->input.ingestThreads = 1;
+    opt->input.queueDepth = URING_QUEUE_DEPTH;
+    opt->input.resolveThreads = 1;
+    opt->input.stats = false;
+    const char *io = NULL;
+
+    for (int i = 4; i < argc; i++) {
+        char *arg = argv[i];
+        if (strncmp(arg, "--root=", 7) == 0) {
+            opt->input.root = arg + 7;
+        } else if (strncmp(arg, "--collection=", 13) == 0) {
+            opt->input.collectionFile = arg + 13;
+        } else if (strncmp(arg, "--pages=", 8) == 0) {
+            opt->input.pageDir = arg + 8;
+        } else if (strncmp(arg, "--archive=", 10) == 0) {
+            opt->input.archive = arg + 10;
+        } else if (strncmp(arg, "--url-table=", 12) == 0) {
+            opt->input.urlTable = arg + 12;
+        } else if (strncmp(arg, "--pack=", 7) == 0) {
+            opt->pack = arg + 7;
+        } else if (strncmp(arg, "--ingest-threads=", 17) == 0) {
+            opt->input.ingestThreads = atoi(arg + 17);
+        } else if (strncmp(arg, "--io=", 5) == 0) {
+            io = arg + 5;
+        } else if (strncmp(arg, "--resolve-threads=", 18) == 0) {
+            opt->input.resolveThreads = atoi(arg + 18);
+        } else if (strncmp(arg, "--queue-depth=", 14) == 0) {
+            opt->input.queueDepth = atoi(arg + 14);
+        } else if (strcmp(arg, "--hugepages=off") == 0) {
+            opt->hugePages = HUGEPAGES_OFF;
+        } else if (strcmp(arg, "--hugepages=thp") == 0) {
+            opt->hugePages = HUGEPAGES_THP;
+        } else if (strcmp(arg, "--hugepages=hugetlb") == 0) {
+            opt->hugePages = HUGEPAGES_HUGETLB;
+        } else if (strcmp(arg, "--prefetch=auto") == 0) {
+            opt->rank.prefetch = PREFETCH_AUTO;
+        } else if (strncmp(arg, "--prefetch=", 11) == 0) {
+            opt->rank.prefetch = atoi(arg + 11);
+            if (opt->rank.prefetch < 0 
+                || opt->rank.prefetch > PREFETCH_MAX_DISTANCE) {
+                fprintf(stderr, "error: prefetch distance must be between "
+                        "0 and %d\n", PREFETCH_MAX_DISTANCE);
+                return false;
+            }
+#ifdef USE_MPI
+        } else if (strcmp(arg, "--async") == 0) {
+            opt->rank.async = true;
+        } else if (strncmp(arg, "--compress=", 11) == 0) {
+            opt->rank.compress = atof(arg + 11);
+            if (opt->rank.compress < 0) {
+                fprintf(stderr, "error: compress threshold can't be "
+                        "negative\n");
+                return false;
+            }
+#endif
+        } else if (strncmp(arg, "--procs=", 8) == 0) {
+            opt->rank.procs = atoi(arg + 8);
+        } else if (strcmp(arg, "--solver=power") == 0) {
+            opt->rank.solver = SOLVER_POWER;
+        } else if (strcmp(arg, "--solver=scc") == 0) {
+            opt->rank.solver = SOLVER_SCC;
+        } else if (strcmp(arg, "--solver=bicgstab") == 0) {
+            opt->rank.solver = SOLVER_BICGSTAB;
+        } else if (strcmp(arg, "--solver=gmres") == 0) {
+            opt->rank.solver = SOLVER_GMRES;
+        } else if (strcmp(arg, "--solver=chebyshev") == 0) {
+            opt->rank.solver = SOLVER_CHEBYSHEV;
+        } else if (strcmp(arg, "--prune") == 0) {
+            opt->rank.prune = true;
+        } else if (strcmp(arg, "--mode=weighted") == 0) {
+            opt->rank.mode = MODE_WEIGHTED;
+        } else if (strcmp(arg, "--mode=classic") == 0) {
+            opt->rank.mode = MODE_CLASSIC;
+        } else if (strcmp(arg, "--coefficients=stored") == 0) {
+            opt->rank.computedCoef = false;
+        } else if (strcmp(arg, "--coefficients=computed") == 0) {
+            opt->rank.computedCoef = true;
+        } else if (strcmp(arg, "--layout=csr") == 0) {
+            opt->rank.layout = LAYOUT_CSR;
+        } else if (strcmp(arg, "--layout=sell") == 0) {
+            opt->rank.layout = LAYOUT_SELL;
+#ifdef USE_DEGREE_BUCKETS
+        } else if (strcmp(arg, "--layout=buckets") == 0) {
+            opt->rank.layout = LAYOUT_BUCKETS;
+#endif
+        } else if (strcmp(arg, "--layout=tiles") == 0) {
+            opt->rank.layout = LAYOUT_TILES;
+        } else if (strcmp(arg, "--hosts=off") == 0) {
+            opt->rank.hosts = HOSTS_OFF;
+        } else if (strcmp(arg, "--hosts=seed") == 0) {
+            opt->rank.hosts = HOSTS_SEED;
+        } else if (strcmp(arg, "--hosts=twolevel") == 0) {
+            opt->rank.hosts = HOSTS_TWOLEVEL;
+        } else if (strcmp(arg, "--stats") == 0) {
+            opt->input.stats = true;
+            opt->rank.stats = true;
+        } else if (strncmp(arg, "--batch=", 8) == 0) {
+            opt->manifest = arg + 8;
+        } else if (strncmp(arg, "--threads=", 10) == 0) {
+            opt->batchThreads = atoi(arg + 10);
+        } else {
+            fprintf(stderr, "error: unknown option %s\n", arg);
+            return false;
+        }
+    }
+    if (opt->input.ingestThreads < 1) opt->input.ingestThreads = 1;
+    if (opt->input.queueDepth < 1) opt->input.queueDepth = 1;
+    if (opt->input.resolveThreads < 1) opt->input.resolveThreads = 1;
+    if (opt->rank.procs < 1) opt->rank.procs = 1;
+    if (opt->rank.procs > 1 && (opt->rank.solver != SOLVER_POWER 
+                                || opt->rank.prune 
+                                || opt->rank.hosts != HOSTS_OFF)) {
+        fprintf(stderr, "error: --procs only runs the power solver\n");
+        return false;
+    }
+#ifdef USE_MPI
+    if (opt->rank.procs > 1 && mpiSize > 1) {
+        fprintf(stderr, "error: --procs runs in a single MPI process\n");
+        return false;
+    }
+#endif
+    if (opt->rank.prune && opt->rank.solver != SOLVER_POWER) {
+        fprintf(stderr, "error: --prune only applies to the power solver\n");
+        return false;
+    }
+    if (opt->rank.mode == MODE_CLASSIC 
+        && (opt->rank.solver != SOLVER_POWER || opt->rank.prune 
+            || opt->rank.hosts != HOSTS_OFF || opt->rank.procs > 1)) {
+        fprintf(stderr, "error: --mode=classic runs the power solver in one "
+                "process without --prune or --hosts\n");
+        return false;
+    }
+    if (opt->rank.computedCoef 
+        && (opt->rank.solver != SOLVER_POWER || opt->rank.prune 
+            || opt->rank.hosts != HOSTS_OFF || opt->rank.procs > 1)) {
+        fprintf(stderr, "error: --coefficients=computed runs the power solver "
+                "in one process without --prune or --hosts\n");
+        return false;
+    }
+    if (opt->rank.layout != LAYOUT_CSR 
+        && (opt->rank.solver != SOLVER_POWER || opt->rank.prune 
+            || opt->rank.hosts != HOSTS_OFF || opt->rank.procs > 1)) {
+        fprintf(stderr, "error: --layout runs the power solver in one "
+                "process without --prune or --hosts\n");
+        return false;
+    }
+    if (opt->rank.layout == LAYOUT_SELL 
+        && (opt->rank.mode != MODE_WEIGHTED || opt->rank.computedCoef)) {
+        fprintf(stderr, "error: --layout=sell needs stored coefficients\n");
+        return false;
+    }
+#ifdef USE_DEGREE_BUCKETS
+    if (opt->rank.layout == LAYOUT_BUCKETS 
+        && (opt->rank.mode != MODE_WEIGHTED || opt->rank.computedCoef)) {
+        fprintf(stderr, "error: --layout=buckets needs stored "
+                "coefficients\n");
+        return false;
+    }
+#endif
+    if (opt->rank.hosts != HOSTS_OFF 
+        && (opt->rank.solver != SOLVER_POWER || opt->rank.prune)) {
+        fprintf(stderr, "error: --hosts only applies to the power solver "
+                "without --prune\n");
+        return false;
+    }
+    if (opt->pack != NULL && opt->input.archive != NULL) {
+        fprintf(stderr, "error: --pack reads the page files, not an archive\n");
+        return false;
+    }
+    if (opt->manifest != NULL && (opt->pack != NULL || opt->rank.procs > 1)) {
+        fprintf(stderr, "error: --batch ranks each collection in one process "
+                "and can't be combined with --pack or --procs\n");
+        return false;
+    }
+    if (opt->manifest != NULL 
+        && ((opt->input.urlTable != NULL && opt->input.urlTable[0] == '/') 
+            || (opt->input.archive != NULL && opt->input.archive[0] == '/'))) {
+        fprintf(stderr, "error: --batch reads --url-table and --archive "
+                "inside each collection, so they must be relative paths\n");
+        return false;
+    }
+
+    // Default to threaded loading when more than one thread was asked for
+    if (io == NULL) {
+        opt->input.mode = opt->input.ingestThreads > 1 ? INGEST_THREADS 
+                                                       : INGEST_SYNC;
+    } else if (strcmp(io, "sync") == 0) {
+        opt->input.mode = INGEST_SYNC;
+    } else if (strcmp(io, "threads") == 0) {
+        opt->input.mode = INGEST_THREADS;
+    } else if (strcmp(io, "uring") == 0) {
+        opt->input.mode = INGEST_URING;
+    } else {
+        fprintf(stderr, "error: unknown io engine %s\n", io);
+        return false;
+    }
+    if (opt->batchThreads < 1) opt->batchThreads = 1;
+    return true;
+}
+
+// Reads the collection file (or the copy of it in the archive) and creates a 
+// Linked List containing the URLs. Returns NULL if the file can't be opened 
+// or is empty.
+List readCollectionFile(const InputConfig *in, Arena *a) {
+    PageFile collection;
+    char *path;
+    if (in->archive != NULL) {
+        path = inputPath(a, in->root, in->archive);
+        collection.data = readArchiveCollection(path, &collection.len);
+        if (collection.data == NULL) return NULL;
+    } else {
+        path = inputPath(a, in->root, in->collectionFile);
+        if (!readFileAt(AT_FDCWD, path, &collection)) return NULL;
     }
     
     // Create the linked list to store the urls
-    char *url = malloc(MAX_STRLEN * sizeof(char) + 1);
-    if (url == NULL) {
-        fprintf(stderr, "error: out of memory\n");
-        exit(EXIT_FAILURE);
-    }
+    List urlList = ListNew();
+    size_t urlSize = 128;
+    char *url = arenaAlloc(a, urlSize);
 
-    while (fscanf(fp, "%s", url) != EOF) {
+    Tokenizer t;
+    tokenizerInit(&t, collection.data, collection.len, false);
+    const char *token;
+    size_t len;
+    while (nextToken(&t, &token, &len)) {
+        // urls can be any length
+        if (len + 1 > urlSize) {
+            while (len + 1 > urlSize) urlSize *= 2;
+            url = arenaAlloc(a, urlSize);
+        }
+        memcpy(url, token, len);
+        url[len] = '\0';
         ListAppend(urlList, url);
     }
 
-    free(url);
-    fclose(fp);
+    free(collection.data);
 
     if (urlList->head == NULL) {
+        fprintf(stderr, "error: no urls in %s\n", path);
         ListFree(urlList);
         return NULL;
     }
@@ -96,253 +1081,4530 @@ List readCollectionFile() {
     return urlList;
 }
 
-Graph createGraph(List l) {
-    Graph g = GraphNew(l->size);
-
-    // Allocate memory the url filename string
-    char *filename = malloc((MAX_STRLEN + strlen(".txt") + 1) * sizeof(char));
-    if (filename == NULL) {
-        fprintf(stderr, "error: out of memory\n");
-        exit(EXIT_FAILURE);
+// Creates the graph from the <url>.txt files in the page directory or the 
+// archive. Returns NULL if any of the files can't be read.
+RankGraph createGraph(List l, const InputConfig *in, Arena *a) {
+    // Hold the page directory open so each file is a single openat lookup
+    int dirFd = -1;
+    if (in->archive == NULL) {
+        char *dir = inputPath(a, in->root, in->pageDir);
+        dirFd = open(dir, O_RDONLY | O_DIRECTORY);
+        if (dirFd < 0) {
+            fprintf(stderr, "open: %s: %s\n", dir, strerror(errno));
+            return NULL;
+        }
     }
-    
-    char *url = malloc(MAX_STRLEN * sizeof(char) + 1);
-    if (url == NULL) {
-        fprintf(stderr, "error: out of memory\n");
-        exit(EXIT_FAILURE);
+
+    // Resolve outlinks through a perfect hash of the collection's urls
+    Ingest ing;
+    ing.l = l;
+    ing.resolveThreads = in->resolveThreads;
+    ing.pending = (OutlinkBuffer){NULL, 0, 0, NULL, 0, 0};
+    const char *tablePath = NULL;
+    if (in->urlTable != NULL) tablePath = inputPath(a, in->root, in->urlTable);
+    if (!buildUrlTable(&ing.urls, l, tablePath, in->stats)) {
+        if (dirFd >= 0) close(dirFd);
+        return NULL;
     }
 
-    for (Node curr = l->head; curr != NULL; curr = curr->next) {
-        // Create a url node for each filename
-        strcpy(filename, curr->url);
-        strcat(filename, ".txt");
+    ing.links = (EdgeList){NULL, 0, 0};
 
-        // Open the url's file
-        FILE *fp = fopen(filename, "r");
-        if (fp == NULL) {
-            fprintf(stderr, "fopen");
-            exit(EXIT_FAILURE);
+    IngestStats *stats = &ing.stats;
+    *stats = (IngestStats){0, 0, 0, "sync", 1, 0, 0, 0};
+    double start = now();
+    IngestMode mode = in->mode;
+    int nThreads = in->ingestThreads;
+    bool ok = true;
+
+    if (in->archive != NULL) {
+        char *path = inputPath(a, in->root, in->archive);
+        ok = insertPagesArchive(&ing, path);
+    } else if (mode == INGEST_URING) {
+        int result = insertPagesUring(&ing, dirFd, in->queueDepth, a);
+        ok = result > 0;
+        if (result < 0) {
+            // io_uring isn't available so use the loader threads instead
+            mode = INGEST_THREADS;
+            if (nThreads < 2) nThreads = URING_FALLBACK_THREADS;
         }
-        // Insert all the edges
-        insertEdges(g, l, fp, url, curr);
+    }
 
+    if (in->archive != NULL) {
+        // already inserted from the archive
+    } else if (mode == INGEST_THREADS && l->size > 1) {
+        ok = insertPagesParallel(&ing, dirFd, nThreads, a);
+    } else if (mode != INGEST_URING) {
+        for (Node curr = l->head; curr != NULL && ok; curr = curr->next) {
+            PageFile pf;
+            ok = readPageFile(dirFd, curr->url, &pf);
+            if (ok) {
+                // Insert all the edges
+                insertEdges(&ing, &pf, curr);
+                free(pf.data);
+            }
+        }
     }
-    free(filename);
-    free(url);
-    return g;
-}
+    if (dirFd >= 0) close(dirFd);
+    stats->seconds = now() - start;
 
-// Reads a url.txt file and inserts all edges the url is adjacent to
-static void insertEdges(Graph g, List l, FILE *fp, char *url, Node curr) {
-    // Move fp to be after the first line
-    char buffer[MAX_STRLEN];
-    fgets(buffer, MAX_STRLEN, fp);
-    int file_offset = strlen(buffer);
-    fseek(fp, file_offset, SEEK_SET);
+    // Join the outlinks collected while parsing against the url table
+    if (ok && ing.resolveThreads > 1) resolveOutlinks(&ing, in->stats);
+    freeLarge(ing.pending.links);
+    freeLarge(ing.pending.pool);
+    freeUrlTable(&ing.urls);
 
-    // Read strings until we read #end
-    while (fscanf(fp, "%s", url) != EOF) {
-        if (strcmp(url, "#end") == 0) break;
-        
-        int outlinkIndex = getUrlIndex(l, url);
-        if (outlinkIndex >= 0 && outlinkIndex != curr->index) {
-            Edge e = {curr->index, outlinkIndex, 1};
-            GraphInsertEdge(g, e);
-        }
+    if (in->stats && ok) {
+        double avgDepth = stats->depthSamples > 0 
+                        ? stats->totalDepth / stats->depthSamples 
+                        : stats->maxDepth;
+        fprintf(statsStream(), "ingest: %d files, %.1f KB in %.3fs "
+                "(%.0f files/s) via %s, queue depth avg %.1f max %d\n", 
+                stats->files, stats->bytes / 1024.0, stats->seconds, 
+                stats->seconds > 0 ? stats->files / stats->seconds : 0, 
+                stats->engine, avgDepth, stats->maxDepth);
+        fprintf(statsStream(),
+                "parse: %.3fs (%.1f MB/s)\n", stats->parseSeconds, 
+                stats->parseSeconds > 0 
+                    ? stats->bytes / stats->parseSeconds / 1e6 : 0);
+    }
+
+    if (!ok) {
+        freeLarge(ing.links.edges);
+        return NULL;
     }
+    return buildRankGraph(&ing.links, l->size);
 }
 
-// Returns the index for url string
-static int getUrlIndex(List l, char *url) {
-    for (Node n = l->head; n != NULL; n = n->next) {
-        if (strcmp(url, n->url) == 0) {
-            return n->index;
+// Appends the link v -> w
+static void addEdge(EdgeList *links, PageId v, PageId w) {
+    if (links->nE == links->capacity) {
+        links->capacity = links->capacity == 0 ? 1024 : links->capacity * 2;
+        links->edges = growLarge(links->edges, links->capacity, 
+                                 sizeof(Edge));
+    }
+    links->edges[links->nE++] = (Edge){v, w};
+}
+
+// Builds the in-link graph from the links, which are freed. Two stable 
+// counting sorts, by source then by target, leave each page's in-links in 
+// increasing order so duplicates are next to each other.
+static RankGraph buildRankGraph(EdgeList *links, PageId nV) {
+    RankGraph g = allocArray(1, sizeof(struct rankGraph));
+    g->nV = nV;
+    g->inStart = allocLarge(nV + 1, sizeof(EdgeIndex));
+    g->inDegree = allocLarge(nV, sizeof(uint32_t));
+    g->outDegree = allocLarge(nV, sizeof(uint32_t));
+    if ((uint64_t)links->nE > MAX_EDGES) {
+        fprintf(stderr, "error: too many edges, rebuild without "
+                "EDGE_INDEX_32\n");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t *start = allocLarge(nV + 1, sizeof(size_t));
+    Edge *sorted = allocLarge(links->nE + 1, sizeof(Edge));
+
+    // Sort by source
+    memset(start, 0, (nV + 1) * sizeof(size_t));
+    for (size_t e = 0; e < links->nE; e++) {
+        start[links->edges[e].v + 1]++;
+    }
+    for (PageId p = 0; p < nV; p++) {
+        start[p + 1] += start[p];
+    }
+    for (size_t e = 0; e < links->nE; e++) {
+        sorted[start[links->edges[e].v]++] = links->edges[e];
+    }
+
+    // Then by target, which keeps the sources in order
+    memset(start, 0, (nV + 1) * sizeof(size_t));
+    for (size_t e = 0; e < links->nE; e++) {
+        start[sorted[e].w + 1]++;
+    }
+    for (PageId p = 0; p < nV; p++) {
+        start[p + 1] += start[p];
+    }
+    for (size_t e = 0; e < links->nE; e++) {
+        links->edges[start[sorted[e].w]++] = sorted[e];
+    }
+    freeLarge(sorted);
+    freeLarge(start);
+
+    // Drop repeated links while copying the sources into place
+    g->inSrc = allocLarge(links->nE + PREFETCH_MAX_DISTANCE, sizeof(PageId));
+    memset(g->inDegree, 0, nV * sizeof(uint32_t));
+    memset(g->outDegree, 0, nV * sizeof(uint32_t));
+    EdgeIndex nE = 0;
+    size_t e = 0;
+    for (PageId pi = 0; pi < nV; pi++) {
+        g->inStart[pi] = nE;
+        for (; e < links->nE && links->edges[e].w == pi; e++) {
+            PageId pj = links->edges[e].v;
+            if (nE > g->inStart[pi] && g->inSrc[nE - 1] == pj) continue;
+            g->inSrc[nE++] = pj;
+            g->outDegree[pj]++;
         }
+        g->inDegree[pi] = nE - g->inStart[pi];
     }
-    return -1;
+    g->inStart[nV] = nE;
+    g->nE = nE;
+    memset(&g->inSrc[nE], 0, PREFETCH_MAX_DISTANCE * sizeof(PageId));
+
+    freeLarge(links->edges);
+    links->edges = NULL;
+    links->nE = 0;
+    links->capacity = 0;
+    return g;
 }
 
-// Calculates page ranks for each url using the given formula
-List calculatePageRank(List l, Graph g, double d, double diffPR, 
-                       int maxIterations) {
-    double N = g->nV;
-    
-    // calculate iteration 0 rank, incoming and outgoing degree
-    initialiseRankAndDegree(l, g, N);
+// Frees the in-link graph
+static void freeRankGraph(RankGraph g) {
+    freeLarge(g->inStart);
+    freeLarge(g->inSrc);
+    freeLarge(g->inDegree);
+    freeLarge(g->outDegree);
+    free(g);
+}
 
-    // Create graphs containing the Win and Wout values for each edge
-    Graph gWin = setGraphWin(l, g);
-    Graph gWout = setGraphWout(l, g);
+// Loads the page files on nThreads threads while this thread inserts the 
+// edges of each file as soon as it has been read. Returns false if any of the 
+// files can't be read.
+static bool insertPagesParallel(Ingest *ing, int dirFd, int nThreads, 
+                                Arena *a) {
+    List l = ing->l;
+    IngestStats *stats = &ing->stats;
+    IngestQueue q;
+    q.nPages = l->size;
+    q.pageDirFd = dirFd;
+    q.next = 0;
+    q.nDone = 0;
+    q.failed = false;
+    q.pages = arenaAlloc(a, l->size * sizeof(Node));
+    q.files = arenaAlloc(a, l->size * sizeof(PageFile));
+    q.done = arenaAlloc(a, l->size * sizeof(int));
+    for (Node n = l->head; n != NULL; n = n->next) {
+        q.pages[n->index] = n;
+    }
+    pthread_mutex_init(&q.lock, NULL);
+    pthread_cond_init(&q.loaded, NULL);
 
-    double diff = diffPR;
-    for (int i = 1; i < maxIterations && diff >= diffPR; i++) {
-        // store the previous rank
-        for (Node pi = l->head; pi != NULL; pi = pi->next) {
-            pi->prevRank = pi->rank;
+    if (nThreads > l->size) nThreads = l->size;
+    stats->engine = "threads";
+    stats->maxDepth = nThreads;
+    pthread_t *loaders = arenaAlloc(a, nThreads * sizeof(pthread_t));
+    for (int i = 0; i < nThreads; i++) {
+        if (pthread_create(&loaders[i], NULL, loadWorker, &q) != 0) {
+            fprintf(stderr, "error: pthread_create\n");
+            exit(EXIT_FAILURE);
         }
-        // Update the rank
-        for (Node pi = l->head; pi != NULL; pi = pi->next) {
+    }
 
-            double weights =  getPageWeight(l, g, gWin, gWout, pi);
-            pi->rank = (1 - d) / N + d * weights;
+    int parsed = 0;
+    pthread_mutex_lock(&q.lock);
+    while (parsed < q.nPages && !q.failed) {
+        if (parsed == q.nDone) {
+            pthread_cond_wait(&q.loaded, &q.lock);
+            continue;
+        }
+        // Parse everything loaded so far without holding the lock
+        int end = q.nDone;
+        pthread_mutex_unlock(&q.lock);
+        for (; parsed < end; parsed++) {
+            int i = q.done[parsed];
+            insertEdges(ing, &q.files[i], q.pages[i]);
+            free(q.files[i].data);
         }
-        diff = calculateDiff(l);
+        pthread_mutex_lock(&q.lock);
     }
-    GraphFree(gWin);
-    GraphFree(gWout);
-    return l;
-}
+    pthread_mutex_unlock(&q.lock);
 
-// Initialises rank to 1/N and sets out/in degree for each url
-static void initialiseRankAndDegree(List l, Graph g, double N) {
-    for (Node pi = l->head; pi != NULL; pi = pi->next) {
-        pi->rank = 1 / N;
-        pi->outDegree = outgoingDegree(g, pi->index);
-        pi->inDegree = incomingDegree(g, pi->index);
+    for (int i = 0; i < nThreads; i++) {
+        pthread_join(loaders[i], NULL);
     }
+    // Files loaded after a failure are never parsed
+    for (; parsed < q.nDone; parsed++) {
+        free(q.files[q.done[parsed]].data);
+    }
+    pthread_mutex_destroy(&q.lock);
+    pthread_cond_destroy(&q.loaded);
+    return !q.failed;
 }
 
-// Takes a url index and returns the corresponding url node
-static Node getNode(List l, int index) {
-    assert(index >= 0 && index < l->size); 
+// Reads page files off the ingest queue until there are none left
+static void *loadWorker(void *arg) {
+    IngestQueue *q = arg;
+    while (true) {
+        pthread_mutex_lock(&q->lock);
+        int i = q->next++;
+        bool stop = i >= q->nPages || q->failed;
+        pthread_mutex_unlock(&q->lock);
+        if (stop) break;
 
-    for (Node n = l->head; n != NULL; n = n->next) {
-        if (n->index == index) return n;
+        bool ok = readPageFile(q->pageDirFd, q->pages[i]->url, &q->files[i]);
+
+        pthread_mutex_lock(&q->lock);
+        if (ok) {
+            q->done[q->nDone++] = i;
+        } else {
+            q->failed = true;
+        }
+        pthread_cond_signal(&q->loaded);
+        pthread_mutex_unlock(&q->lock);
     }
     return NULL;
 }
 
-// Sets the Win for each edge in the graph
-static Graph setGraphWin(List l, Graph g) {
-    Graph gWin = GraphNew(g->nV);
-    for (int pj = 0; pj < g->nV; pj++) {
-        for (int pi = 0; pi < g->nV; pi++) {
-            // don't include self loops
-            if (isAdjacent(g, pj, pi) && pj != pi) {
-                Node pjNode = getNode(l, pj);
-                Node piNode = getNode(l, pi);
-                double Win = calculateWin(l, g, pjNode, piNode);
+#ifdef HAVE_IO_URING
 
-                Edge e = {pj, pi, Win};
-                GraphInsertEdge(gWin, e);
+// Submission and completion rings shared with the kernel
+typedef struct {
+    int fd;
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned *sqMask;
+    unsigned *sqArray;
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned *cqMask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sqRing;
+    void *cqRing;
+    size_t sqRingSize;
+    size_t cqRingSize;
+    size_t sqesSize;
+    unsigned toSubmit;
+} Uring;
+
+// A page file being opened or read through the ring. Buffers are kept and 
+// reused by the next file that gets the slot.
+typedef struct {
+    int page;
+    int fd;
+    bool opening;
+    char *filename;
+    size_t filenameSize;
+    PageFile pf;
+    size_t capacity;
+} UringSlot;
+
+static bool uringInit(Uring *r, unsigned entries);
+static void uringFree(Uring *r);
+static struct io_uring_sqe *uringGetSqe(Uring *r);
+static void uringPrepOpen(Uring *r, int dirFd, UringSlot *s, int slot);
+static void uringPrepRead(Uring *r, UringSlot *s, int slot);
+
+// Loads the page files through io_uring with up to queueDepth files in 
+// flight, inserting the edges of each file as it completes while the kernel 
+// works on the others. Returns 1 on success, 0 if a file can't be read and 
+// -1 if io_uring isn't supported, in which case nothing has been inserted.
+static int insertPagesUring(Ingest *ing, int dirFd, int queueDepth, Arena *a) {
+    List l = ing->l;
+    IngestStats *stats = &ing->stats;
+    Uring r;
+    if (!uringInit(&r, queueDepth)) return -1;
+    stats->engine = "io_uring";
+    stats->maxDepth = 0;
+
+    Node *pages = arenaAlloc(a, l->size * sizeof(Node));
+    for (Node n = l->head; n != NULL; n = n->next) {
+        pages[n->index] = n;
+    }
+
+    UringSlot *slots = arenaAlloc(a, queueDepth * sizeof(UringSlot));
+    int *freeSlots = arenaAlloc(a, queueDepth * sizeof(int));
+    for (int i = 0; i < queueDepth; i++) {
+        slots[i] = (UringSlot){-1, -1, false, NULL, 0, {NULL, 0}, 0};
+        freeSlots[i] = i;
+    }
+    int nFree = queueDepth;
+
+    int next = 0;
+    int completed = 0;
+    bool ok = true;
+    while (completed < l->size && ok) {
+        // Keep the queue full of opens for the next pages
+        while (nFree > 0 && next < l->size) {
+            int slot = freeSlots[--nFree];
+            UringSlot *s = &slots[slot];
+            s->page = next++;
+
+            size_t nameLen = strlen(pages[s->page]->url) + strlen(".txt") + 1;
+            if (nameLen > s->filenameSize) {
+                free(s->filename);
+                s->filename = malloc(nameLen);
+                s->filenameSize = nameLen;
+            }
+            if (s->capacity == 0) {
+                s->capacity = URING_READ_SIZE;
+                s->pf.data = malloc(s->capacity + 1);
+            }
+            if (s->filename == NULL || s->pf.data == NULL) {
+                fprintf(stderr, "error: out of memory\n");
+                exit(EXIT_FAILURE);
             }
+            snprintf(s->filename, nameLen, "%s.txt", pages[s->page]->url);
+            uringPrepOpen(&r, dirFd, s, slot);
         }
-    }
-    return gWin;
-}
 
-// Sets the Wout for each edge in the graph
-static Graph setGraphWout(List l, Graph g) {
-    Graph gWout = GraphNew(g->nV);
-    for (int pj = 0; pj < g->nV; pj++) {
-        for (int pi = 0; pi < g->nV; pi++) {
-            if (isAdjacent(g, pj, pi) && pj != pi) {
-                Node pjNode = getNode(l, pj);
-                Node piNode = getNode(l, pi);
-                double Wout = calculateWout(l, g, pjNode, piNode);
+        int inFlight = queueDepth - nFree;
+        if (inFlight > stats->maxDepth) stats->maxDepth = inFlight;
+        stats->totalDepth += inFlight;
+        stats->depthSamples++;
+
+        int ret = syscall(__NR_io_uring_enter, r.fd, r.toSubmit, 1, 
+                          IORING_ENTER_GETEVENTS, NULL, 0);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "io_uring_enter: %s\n", strerror(errno));
+            ok = false;
+            break;
+        }
+        r.toSubmit -= ret;
+
+        unsigned head = *r.cqHead;
+        unsigned tail = __atomic_load_n(r.cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            struct io_uring_cqe *cqe = &r.cqes[head & *r.cqMask];
+            int slot = cqe->user_data;
+            UringSlot *s = &slots[slot];
+
+            if (cqe->res < 0) {
+                fprintf(stderr, "%s: %s: %s\n", s->opening ? "open" : "read",
+                        s->filename, strerror(-cqe->res));
+                ok = false;
+                s->opening = false;
+                freeSlots[nFree++] = slot;
+                continue;
+            }
+
+            if (s->opening) {
+                s->opening = false;
+                s->fd = cqe->res;
+                s->pf.len = 0;
+                uringPrepRead(&r, s, slot);
+                continue;
+            }
 
-                Edge e = {pj, pi, Wout};
-                GraphInsertEdge(gWout, e);
+            // A full buffer means there may be more of the file to read
+            size_t requested = s->capacity - s->pf.len;
+            s->pf.len += cqe->res;
+            if ((size_t)cqe->res == requested) {
+                s->capacity *= 2;
+                s->pf.data = realloc(s->pf.data, s->capacity + 1);
+                if (s->pf.data == NULL) {
+                    fprintf(stderr, "error: out of memory\n");
+                    exit(EXIT_FAILURE);
+                }
+                uringPrepRead(&r, s, slot);
+                continue;
             }
+
+            close(s->fd);
+            s->fd = -1;
+            s->pf.data[s->pf.len] = '\0';
+            if (ok) insertEdges(ing, &s->pf, pages[s->page]);
+            completed++;
+            freeSlots[nFree++] = slot;
+        }
+        __atomic_store_n(r.cqHead, head, __ATOMIC_RELEASE);
+    }
+
+    // Wait for anything still in flight before the slots are freed
+    while (nFree < queueDepth && !ok) {
+        if (syscall(__NR_io_uring_enter, r.fd, r.toSubmit, 1, 
+                    IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR) {
+            break;
+        }
+        r.toSubmit = 0;
+        unsigned head = *r.cqHead;
+        unsigned tail = __atomic_load_n(r.cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            struct io_uring_cqe *cqe = &r.cqes[head & *r.cqMask];
+            UringSlot *s = &slots[cqe->user_data];
+            if (s->opening && cqe->res >= 0) close(cqe->res);
+            s->opening = false;
+            freeSlots[nFree++] = cqe->user_data;
         }
+        __atomic_store_n(r.cqHead, head, __ATOMIC_RELEASE);
+    }
+
+    for (int i = 0; i < queueDepth; i++) {
+        if (slots[i].fd >= 0) close(slots[i].fd);
+        free(slots[i].filename);
+        free(slots[i].pf.data);
     }
-    return gWout;
+    uringFree(&r);
+    return ok ? 1 : 0;
 }
 
-// Calculates the Win for each edge
-static double calculateWin(List l, Graph g, Node pj, Node pi) {
-    // Store all the incoming links 
-    double pjTotalIncomingLinks = 0;
-    int pjRow = pj->index;
-    for (int pjCol = 0; pjCol < g->nV; pjCol++) {
-        if (isAdjacent(g, pjRow, pjCol)) {
-            Node refPage = getNode(l, pjCol);
-            pjTotalIncomingLinks += refPage->inDegree;
+// Sets up a ring with room for entries submissions. Returns false if the 
+// kernel doesn't support io_uring or the operations the loader needs.
+static bool uringInit(Uring *r, unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    r->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (r->fd < 0) return false;
+
+    // Opening files through the ring needs a 5.6 or newer kernel
+    size_t probeSize = sizeof(struct io_uring_probe) 
+                     + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, probeSize);
+    if (probe == NULL) {
+        fprintf(stderr, "error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    bool supported = 
+        syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_PROBE, 
+                probe, 256) == 0
+        && probe->last_op >= IORING_OP_READ
+        && (probe->ops[IORING_OP_OPENAT].flags & IO_URING_OP_SUPPORTED)
+        && (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED);
+    free(probe);
+    if (!supported) {
+        close(r->fd);
+        return false;
+    }
+
+    r->sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cqRingSize > r->sqRingSize) r->sqRingSize = r->cqRingSize;
+        r->cqRingSize = r->sqRingSize;
+    }
+    r->sqRing = mmap(NULL, r->sqRingSize, PROT_READ | PROT_WRITE, 
+                     MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->sqRing == MAP_FAILED) {
+        close(r->fd);
+        return false;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cqRing = r->sqRing;
+    } else {
+        r->cqRing = mmap(NULL, r->cqRingSize, PROT_READ | PROT_WRITE, 
+                         MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+    }
+    r->sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqesSize, PROT_READ | PROT_WRITE, 
+                   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->cqRing == MAP_FAILED || r->sqes == MAP_FAILED) {
+        if (r->cqRing != MAP_FAILED && r->cqRing != r->sqRing) {
+            munmap(r->cqRing, r->cqRingSize);
         }
+        if (r->sqes != MAP_FAILED) munmap(r->sqes, r->sqesSize);
+        munmap(r->sqRing, r->sqRingSize);
+        close(r->fd);
+        return false;
     }
-    return pi->inDegree / pjTotalIncomingLinks;
+
+    char *sq = r->sqRing;
+    char *cq = r->cqRing;
+    r->sqHead = (unsigned *)(sq + p.sq_off.head);
+    r->sqTail = (unsigned *)(sq + p.sq_off.tail);
+    r->sqMask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sqArray = (unsigned *)(sq + p.sq_off.array);
+    r->cqHead = (unsigned *)(cq + p.cq_off.head);
+    r->cqTail = (unsigned *)(cq + p.cq_off.tail);
+    r->cqMask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    r->toSubmit = 0;
+    return true;
 }
 
-// Returns true if edges[v][w] == 1, else false.
-static bool isAdjacent(Graph g, int v, int w) {
-    if (g->edges[v][w] != 0) return true;
-    return false; 
+// Unmaps the rings and closes the ring fd
+static void uringFree(Uring *r) {
+    munmap(r->sqes, r->sqesSize);
+    if (r->cqRing != r->sqRing) munmap(r->cqRing, r->cqRingSize);
+    munmap(r->sqRing, r->sqRingSize);
+    close(r->fd);
 }
 
-// Returns the number of incoming links for a url
-static double incomingDegree(Graph g, int urlA) {
-    int degree = 0;
-    for (int urlB = 0; urlB < g->nV; urlB++) {
-        // for each urlB check if it is an incoming link in urlA (i.e. urlB -> urlA)
-        if (isAdjacent(g, urlB, urlA)) {
-            degree++;
-        }
+// Returns the next free submission entry, cleared. The loader never has more 
+// operations queued than the ring has entries so there is always one free.
+static struct io_uring_sqe *uringGetSqe(Uring *r) {
+    unsigned tail = *r->sqTail;
+    unsigned index = tail & *r->sqMask;
+    struct io_uring_sqe *sqe = &r->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    r->sqArray[index] = index;
+    __atomic_store_n(r->sqTail, tail + 1, __ATOMIC_RELEASE);
+    r->toSubmit++;
+    return sqe;
+}
+
+// Queues an open of the slot's file relative to the page directory
+static void uringPrepOpen(Uring *r, int dirFd, UringSlot *s, int slot) {
+    struct io_uring_sqe *sqe = uringGetSqe(r);
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = dirFd;
+    sqe->addr = (unsigned long)s->filename;
+    sqe->open_flags = O_RDONLY;
+    sqe->user_data = slot;
+    s->opening = true;
+}
+
+// Queues a read into the rest of the slot's buffer
+static void uringPrepRead(Uring *r, UringSlot *s, int slot) {
+    struct io_uring_sqe *sqe = uringGetSqe(r);
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = s->fd;
+    sqe->addr = (unsigned long)(s->pf.data + s->pf.len);
+    sqe->len = s->capacity - s->pf.len;
+    sqe->off = s->pf.len;
+    sqe->user_data = slot;
+}
+
+#else
+
+// io_uring isn't available on this platform
+static int insertPagesUring(Ingest *ing, int dirFd, int queueDepth, Arena *a) {
+    (void)ing, (void)dirFd, (void)queueDepth, (void)a;
+    return -1;
+}
+
+#endif
+
+// Reads <url>.txt in the directory dirFd into memory. The data is NUL 
+// terminated and must be freed by the caller. Returns false on failure.
+static bool readPageFile(int dirFd, const char *url, PageFile *pf) {
+    size_t nameLen = strlen(url) + strlen(".txt") + 1;
+    char *filename = malloc(nameLen);
+    if (filename == NULL) {
+        fprintf(stderr, "error: out of memory\n");
+        exit(EXIT_FAILURE);
     }
-    return degree;
+    snprintf(filename, nameLen, "%s.txt", url);
+
+    bool ok = readFileAt(dirFd, filename, pf);
+    free(filename);
+    return ok;
 }
 
-// Returns the number of outgoing links for a url
-static double outgoingDegree(Graph g, int urlA) {
-    double degree = 0;
+// Reads filename relative to the directory dirFd into memory. The data is 
+// NUL terminated and must be freed by the caller. Returns false on failure.
+static bool readFileAt(int dirFd, const char *filename, PageFile *pf) {
+    int fd = openat(dirFd, filename, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        fprintf(stderr, "open: %s: %s\n", filename, strerror(errno));
+        if (fd >= 0) close(fd);
+        return false;
+    }
+
+    size_t capacity = st.st_size > 0 ? st.st_size : 4096;
+    pf->data = malloc(capacity + 1);
+    pf->len = 0;
+    if (pf->data == NULL) {
+        fprintf(stderr, "error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
 
-    for (int urlB = 0; urlB < g->nV; urlB++) {
-        if (isAdjacent(g, urlA, urlB)) {
-            degree++;
+    while (true) {
+        // The file may have grown since fstat
+        if (pf->len == capacity) {
+            capacity *= 2;
+            pf->data = realloc(pf->data, capacity + 1);
+            if (pf->data == NULL) {
+                fprintf(stderr, "error: out of memory\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        ssize_t n = read(fd, pf->data + pf->len, capacity - pf->len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            fprintf(stderr, "read: %s: %s\n", filename, strerror(errno));
+            free(pf->data);
+            close(fd);
+            return false;
         }
+        if (n == 0) break;
+        pf->len += n;
     }
-    return degree;
+    pf->data[pf->len] = '\0';
+
+    close(fd);
+    return true;
 }
 
-// Calculates the Wout for an edge
-static double calculateWout(List l, Graph g, Node pj, Node pi) {
+//
+// Collection Archives
+//
+
+// Inserts the edges of every page file in the archive. The page files are 
+// stored in collection order so they are read front to back in 
+// ARCHIVE_READ_SIZE chunks. Returns false if the archive is invalid or 
+// doesn't match the collection.
+static bool insertPagesArchive(Ingest *ing, const char *path) {
+    List l = ing->l;
+    IngestStats *stats = &ing->stats;
+    ArchiveHeader h;
+    int fd = openArchive(path, &h);
+    if (fd < 0) return false;
+    stats->engine = "archive";
 
-    // Set to 0.5 if pi == 0 per spec
-    double piOutgoingLinks = pi->outDegree;
-    if (piOutgoingLinks == 0) {
-        piOutgoingLinks = 0.5;
+    char *index = malloc(h.indexLength + 1);
+    size_t capacity = ARCHIVE_READ_SIZE;
+    char *buf = malloc(capacity);
+    if (index == NULL || buf == NULL) {
+        fprintf(stderr, "error: out of memory\n");
+        exit(EXIT_FAILURE);
     }
 
-    double pjTotalOutgoingLinks = 0;
-    int pjRow = pj->index;
-    for (int pjCol = 0; pjCol < g->nV; pjCol++) {
+    bool ok = h.nPages == (uint32_t)l->size 
+           && preadFull(fd, index, h.indexLength, h.indexOffset);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
 
-        if (isAdjacent(g, pjRow, pjCol)) {
-            Node refPage = getNode(l, pjCol);
-            if (refPage->outDegree == 0) {
-                pjTotalOutgoingLinks += 0.5;
-            } else {
-                pjTotalOutgoingLinks += refPage->outDegree;
+    // The window of the archive currently in buf
+    uint64_t bufStart = 0;
+    size_t bufLen = 0;
+    size_t pos = 0;
+    Node curr = l->head;
+    for (uint32_t i = 0; ok && i < h.nPages; i++, curr = curr->next) {
+        uint64_t offset, length;
+        uint32_t urlLen;
+        if (pos + 20 > h.indexLength) {
+            ok = false;
+            break;
+        }
+        memcpy(&offset, index + pos, 8);
+        memcpy(&length, index + pos + 8, 8);
+        memcpy(&urlLen, index + pos + 16, 4);
+        pos += 20;
+
+        // Entries must be in collection order and move forward through the file
+        ok = pos + urlLen <= h.indexLength 
+          && urlLen == strlen(curr->url)
+          && memcmp(index + pos, curr->url, urlLen) == 0
+          && offset >= bufStart;
+        pos += urlLen;
+        if (!ok) break;
+
+        if (offset + length > bufStart + bufLen) {
+            // Keep the part of the window this page starts in and refill
+            size_t keep = bufStart + bufLen > offset 
+                        ? bufStart + bufLen - offset : 0;
+            memmove(buf, buf + (bufLen - keep), keep);
+            bufStart = offset;
+            bufLen = keep;
+            if (length > capacity) {
+                capacity = length;
+                buf = realloc(buf, capacity);
+                if (buf == NULL) {
+                    fprintf(stderr, "error: out of memory\n");
+                    exit(EXIT_FAILURE);
+                }
             }
+            while (bufLen < length) {
+                ssize_t n = pread(fd, buf + bufLen, capacity - bufLen, 
+                                  bufStart + bufLen);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) break;
+                bufLen += n;
+            }
+            ok = bufLen >= length;
+            if (!ok) break;
         }
+
+        PageFile pf = {buf + (offset - bufStart), length};
+        insertEdges(ing, &pf, curr);
     }
-    // Set to 0.5 per spec if == 0
-    if (pjTotalOutgoingLinks == 0) {
-        pjTotalOutgoingLinks = 0.5;
-    } 
-    return piOutgoingLinks / pjTotalOutgoingLinks;
+
+    if (!ok) fprintf(stderr, "error: %s is truncated or corrupt\n", path);
+    free(index);
+    free(buf);
+    close(fd);
+    return ok;
 }
 
-// Calculates the page weight 
-static double getPageWeight(List l, Graph g, Graph gWin, Graph gWout, Node pi) {
-    int piIndex = pi->index;
-    double totalWeight = 0;
-    for (int pjIndex = 0; pjIndex < g->nV; pjIndex++) {
-        if (isAdjacent(g, pjIndex, piIndex)) {
-            Node pj = getNode(l, pjIndex);
-            double Wout = gWout->edges[pjIndex][piIndex];
-            double Win = gWin->edges[pjIndex][piIndex];
-            double weight = pj->prevRank * Wout * Win;
-            totalWeight += weight;
-        }
+// Returns the collection file stored in the archive, which must be freed by 
+// the caller, or NULL if the archive can't be read
+static char *readArchiveCollection(const char *path, size_t *len) {
+    ArchiveHeader h;
+    int fd = openArchive(path, &h);
+    if (fd < 0) return NULL;
+
+    char *collection = malloc(h.collectionLength + 1);
+    if (collection == NULL) {
+        fprintf(stderr, "error: out of memory\n");
+        exit(EXIT_FAILURE);
     }
-    return totalWeight;
+    if (!preadFull(fd, collection, h.collectionLength, h.collectionOffset)) {
+        fprintf(stderr, "error: %s is truncated\n", path);
+        free(collection);
+        close(fd);
+        return NULL;
+    }
+    collection[h.collectionLength] = '\0';
+    *len = h.collectionLength;
+    close(fd);
+    return collection;
 }
 
-// Calculates the diff for each iteration cycle
-static double calculateDiff(List l) {
-    double diff = 0;
-    for (Node pi = l->head; pi != NULL; pi = pi->next) {
-        diff += fabs(pi->rank - pi->prevRank);
+// Opens an archive and reads its header. Returns the fd or -1 on failure.
+static int openArchive(const char *path, ArchiveHeader *h) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "open: %s: %s\n", path, strerror(errno));
+        return -1;
     }
-    return diff;
-}
\ No newline at end of file
+    if (!preadFull(fd, h, sizeof(*h), 0) 
+        || memcmp(h->magic, ARCHIVE_MAGIC, sizeof(h->magic)) != 0) {
+        fprintf(stderr, "error: %s is not a collection archive\n", path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Reads exactly len bytes at offset. Returns false on error or end of file.
+static bool preadFull(int fd, void *buf, size_t len, uint64_t offset) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = pread(fd, (char *)buf + done, len - done, offset + done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += n;
+    }
+    return true;
+}
+
+// Packs the collection file and every page file into a single archive at 
+// packPath (relative to the input root). Returns the process exit status.
+static int packCollection(const InputConfig *in, const char *packPath) {
+    Arena scratch = {NULL, NULL};
+    List l = readCollectionFile(in, &scratch);
+    if (l == NULL) {
+        arenaFree(&scratch);
+        return EXIT_FAILURE;
+    }
+
+    PageFile collection;
+    char *dir = inputPath(&scratch, in->root, in->pageDir);
+    int dirFd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (dirFd < 0) {
+        fprintf(stderr, "open: %s: %s\n", dir, strerror(errno));
+    }
+    char *collectionPath = inputPath(&scratch, in->root, in->collectionFile);
+    char *path = inputPath(&scratch, in->root, packPath);
+    FILE *out = NULL;
+    if (dirFd >= 0 && readFileAt(AT_FDCWD, collectionPath, &collection)) {
+        out = fopen(path, "wb");
+        if (out == NULL) {
+            fprintf(stderr, "fopen: %s\n", path);
+            free(collection.data);
+        }
+    }
+    if (out == NULL) {
+        if (dirFd >= 0) close(dirFd);
+        ListFree(l);
+        arenaFree(&scratch);
+        return EXIT_FAILURE;
+    }
+
+    // The header is rewritten once the index offset is known
+    ArchiveHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, ARCHIVE_MAGIC, sizeof(h.magic));
+    h.nPages = l->size;
+    h.collectionOffset = sizeof(h);
+    h.collectionLength = collection.len;
+    fwrite(&h, sizeof(h), 1, out);
+    fwrite(collection.data, 1, collection.len, out);
+    free(collection.data);
+
+    uint64_t *offsets = arenaAlloc(&scratch, l->size * sizeof(uint64_t));
+    uint64_t *lengths = arenaAlloc(&scratch, l->size * sizeof(uint64_t));
+    uint64_t offset = h.collectionOffset + h.collectionLength;
+    bool ok = true;
+    int i = 0;
+    for (Node curr = l->head; curr != NULL && ok; curr = curr->next, i++) {
+        PageFile pf;
+        ok = readPageFile(dirFd, curr->url, &pf);
+        if (ok) {
+            fwrite(pf.data, 1, pf.len, out);
+            offsets[i] = offset;
+            lengths[i] = pf.len;
+            offset += pf.len;
+            free(pf.data);
+        }
+    }
+    close(dirFd);
+
+    h.indexOffset = offset;
+    i = 0;
+    for (Node curr = l->head; curr != NULL && ok; curr = curr->next, i++) {
+        uint32_t urlLen = strlen(curr->url);
+        fwrite(&offsets[i], 8, 1, out);
+        fwrite(&lengths[i], 8, 1, out);
+        fwrite(&urlLen, 4, 1, out);
+        fwrite(curr->url, 1, urlLen, out);
+        h.indexLength += 20 + urlLen;
+    }
+
+    if (ok) {
+        fseek(out, 0, SEEK_SET);
+        fwrite(&h, sizeof(h), 1, out);
+    }
+    if (ferror(out)) {
+        fprintf(stderr, "error: failed to write %s\n", path);
+        ok = false;
+    }
+    if (fclose(out) != 0) ok = false;
+    if (!ok) remove(path);
+
+    ListFree(l);
+    arenaFree(&scratch);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Inserts all edges listed in a url.txt file that has been read into memory
+static void insertEdges(Ingest *ing, const PageFile *pf, Node curr) {
+    double start = now();
+
+    // Start after the "#start Section-1" line
+    Tokenizer t;
+    tokenizerInit(&t, pf->data, pf->len, true);
+
+    // Read strings until we read #end
+    const char *url;
+    size_t len;
+    while (nextToken(&t, &url, &len)) {
+        if (len == 4 && memcmp(url, "#end", 4) == 0) break;
+
+        // Leave the lookup to the hash join when it runs on several threads
+        if (ing->resolveThreads > 1) {
+            uint64_t hash = hashUrl(url, len, ing->urls.seed);
+            deferOutlink(ing, url, len, hash, curr->index);
+            continue;
+        }
+        
+        int outlinkIndex = getUrlIndex(&ing->urls, url, len);
+        if (outlinkIndex >= 0 && outlinkIndex != curr->index) {
+            addEdge(&ing->links, curr->index, outlinkIndex);
+        }
+    }
+
+    ing->stats.files++;
+    ing->stats.bytes += pf->len;
+    ing->stats.parseSeconds += now() - start;
+}
+
+// Bytes that separate tokens, the same set fscanf's %s stops at
+static const bool isSeparator[256] = {
+    [' '] = true, ['\t'] = true, ['\n'] = true, 
+    ['\v'] = true, ['\f'] = true, ['\r'] = true,
+};
+
+// Starts tokenizing len bytes of data. Page files skip their first line, 
+// however long it is, with a single memchr.
+static void tokenizerInit(Tokenizer *t, const char *data, size_t len, 
+                          bool skipFirstLine) {
+    t->pos = (const unsigned char *)data;
+    t->end = t->pos + len;
+    if (skipFirstLine) {
+        const unsigned char *newline = memchr(t->pos, '\n', len);
+        t->pos = newline != NULL ? newline + 1 : t->end;
+    }
+}
+
+// Sets token and len to the next token, which is not NUL terminated. Tokens 
+// can be any length and CRLF line endings are treated as whitespace. Returns 
+// false once there are no tokens left.
+static inline bool nextToken(Tokenizer *t, const char **token, size_t *len) {
+    const unsigned char *p = t->pos;
+    const unsigned char *end = t->end;
+    while (p < end && isSeparator[*p]) p++;
+    if (p == end) {
+        t->pos = p;
+        return false;
+    }
+
+    const unsigned char *start = p;
+    while (p < end && !isSeparator[*p]) p++;
+    *token = (const char *)start;
+    *len = p - start;
+    t->pos = p;
+    return true;
+}
+
+// Copies an outlink token into the pending buffer for the hash join
+static void deferOutlink(Ingest *ing, const char *url, size_t len, 
+                         uint64_t hash, int source) {
+    OutlinkBuffer *b = &ing->pending;
+    if (b->nLinks == b->capacity) {
+        b->capacity = b->capacity == 0 ? 1024 : b->capacity * 2;
+        b->links = growLarge(b->links, b->capacity, sizeof(Outlink));
+    }
+    if (b->poolLen + len > b->poolCapacity) {
+        while (b->poolLen + len > b->poolCapacity) {
+            b->poolCapacity = b->poolCapacity == 0 ? 64 * 1024 
+                                                   : b->poolCapacity * 2;
+        }
+        b->pool = growLarge(b->pool, b->poolCapacity, 1);
+    }
+
+    memcpy(b->pool + b->poolLen, url, len);
+    b->links[b->nLinks++] = (Outlink){hash, b->poolLen, len, source};
+    b->poolLen += len;
+}
+
+// Resolves the pending outlinks to page indexes with a partitioned hash join 
+// on the resolve threads, then inserts the edges. Unknown urls and self 
+// loops are dropped just like when outlinks are resolved while parsing.
+static void resolveOutlinks(Ingest *ing, bool stats) {
+    double start = now();
+    OutlinkBuffer *b = &ing->pending;
+    int nThreads = ing->resolveThreads;
+
+    // Several partitions per thread keeps the threads busy to the end
+    int bits = 0;
+    while ((1 << bits) < nThreads * 8) bits++;
+    int nParts = 1 << bits;
+
+    size_t *partStart = calloc(nParts + 1, sizeof(size_t));
+    size_t *fill = calloc(nParts, sizeof(size_t));
+    Outlink *links = allocLarge(b->nLinks + 1, sizeof(Outlink));
+    int32_t *targets = allocLarge(b->nLinks + 1, sizeof(int32_t));
+    if (partStart == NULL || fill == NULL) {
+        fprintf(stderr, "error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Partition by the top bits of the hash
+    for (size_t i = 0; i < b->nLinks; i++) {
+        partStart[(b->links[i].hash >> (63 - bits) >> 1) + 1]++;
+    }
+    for (int p = 0; p < nParts; p++) {
+        partStart[p + 1] += partStart[p];
+    }
+    for (size_t i = 0; i < b->nLinks; i++) {
+        int p = b->links[i].hash >> (63 - bits) >> 1;
+        links[partStart[p] + fill[p]++] = b->links[i];
+    }
+
+    JoinQueue q = {&ing->urls, links, b->pool, partStart, nParts, 0, 
+                   targets, PTHREAD_MUTEX_INITIALIZER};
+    pthread_t *workers = malloc(nThreads * sizeof(pthread_t));
+    if (workers == NULL) {
+        fprintf(stderr, "error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < nThreads; i++) {
+        if (pthread_create(&workers[i], NULL, joinWorker, &q) != 0) {
+            fprintf(stderr, "error: pthread_create\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int i = 0; i < nThreads; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    double joinSeconds = now() - start;
+
+    size_t dropped = 0;
+    for (size_t i = 0; i < b->nLinks; i++) {
+        if (targets[i] < 0) {
+            dropped++;
+            continue;
+        }
+        addEdge(&ing->links, links[i].source, targets[i]);
+    }
+
+    if (stats) {
+        fprintf(statsStream(),
+                "resolve: %zu outlinks (%zu dropped) joined in %.3fs "
+                "on %d threads, %.3fs total\n", b->nLinks, dropped, 
+                joinSeconds, nThreads, now() - start);
+    }
+
+    pthread_mutex_destroy(&q.lock);
+    free(workers);
+    free(partStart);
+    free(fill);
+    freeLarge(links);
+    freeLarge(targets);
+}
+
+// Resolves partitions of outlinks until there are none left
+static void *joinWorker(void *arg) {
+    JoinQueue *q = arg;
+    while (true) {
+        pthread_mutex_lock(&q->lock);
+        int p = q->next++;
+        pthread_mutex_unlock(&q->lock);
+        if (p >= q->nParts) break;
+
+        for (size_t i = q->partStart[p]; i < q->partStart[p + 1]; i++) {
+            const Outlink *o = &q->links[i];
+            int target = findUrl(q->urls, q->pool + o->offset, o->len, 
+                                 o->hash);
+            q->targets[i] = target == (int)o->source ? -1 : target;
+        }
+    }
+    return NULL;
+}
+
+// Returns the index for a url string of length len, or -1 if it isn't in 
+// the collection
+static int getUrlIndex(const UrlTable *t, const char *url, size_t len) {
+    return findUrl(t, url, len, hashUrl(url, len, t->seed));
+}
+
+// Looks up a url whose hash h has already been computed with the table's seed
+static int findUrl(const UrlTable *t, const char *url, size_t len, 
+                   uint64_t h) {
+    uint32_t bucket = ((h >> 32) * t->nBuckets) >> 32;
+    uint64_t pilotHash = mix64(t->pilots[bucket] ^ t->seed);
+    uint32_t slot = ((mix64(h ^ pilotHash) & 0xffffffff) * t->nSlots) >> 32;
+
+    uint32_t page = t->slotPage[slot];
+    if (t->urlLens[page] == len && memcmp(t->urls[page], url, len) == 0) {
+        return page;
+    }
+    return -1;
+}
+
+// Sets up the url table for the collection. When path is given the table is 
+// loaded from it if it was built for the same urls, otherwise it is built and 
+// saved there for the next run. Returns false if the table can't be built.
+static bool buildUrlTable(UrlTable *t, List l, const char *path, 
+                          bool stats) {
+    double start = now();
+    t->pilots = NULL;
+    t->slotPage = NULL;
+    t->urls = allocLarge(l->size, sizeof(char *));
+    t->urlLens = allocLarge(l->size, sizeof(uint32_t));
+
+    // The fingerprint ties a saved table to this exact list of urls
+    uint64_t fingerprint = l->size;
+    for (Node n = l->head; n != NULL; n = n->next) {
+        t->urls[n->index] = n->url;
+        t->urlLens[n->index] = strlen(n->url);
+        fingerprint = mix64(fingerprint ^ hashUrl(n->url, 
+            t->urlLens[n->index], URL_FINGERPRINT_SEED));
+    }
+    t->nPages = l->size;
+
+    const char *source = "loaded";
+    if (path == NULL || !loadUrlTable(t, path, fingerprint)) {
+        // Retry with a new seed in the rare case pilots can't be found
+        uint64_t seed = 0;
+        while (!buildPerfectHash(t, seed)) {
+            if (++seed == 16) {
+                fprintf(stderr, "error: failed to build the url table\n");
+                freeUrlTable(t);
+                return false;
+            }
+        }
+        if (path != NULL) saveUrlTable(t, path, fingerprint);
+        source = "built";
+    }
+
+    if (stats) {
+        fprintf(statsStream(),
+                "url table: %s for %d urls (%u slots, %u buckets) "
+                "in %.3fs\n", source, l->size, t->nSlots, t->nBuckets, 
+                now() - start);
+    }
+    return true;
+}
+
+// Builds the perfect hash over t's urls, placing the largest buckets first. 
+// Duplicate urls keep the first index like a linear search would. Returns 
+// false if a bucket runs out of pilots, in which case another seed is needed.
+static bool buildPerfectHash(UrlTable *t, uint64_t seed) {
+    uint32_t nPages = t->nPages;
+    UrlKey *keys = allocLarge(nPages, sizeof(UrlKey));
+    for (uint32_t i = 0; i < nPages; i++) {
+        keys[i].hash = hashUrl(t->urls[i], t->urlLens[i], seed);
+        keys[i].page = i;
+    }
+    qsort(keys, nPages, sizeof(UrlKey), compareKeys);
+
+    // Drop repeated urls. Different urls with the same hash need a new seed.
+    uint32_t nKeys = 0;
+    for (uint32_t i = 0; i < nPages; i++) {
+        if (nKeys > 0 && keys[nKeys - 1].hash == keys[i].hash) {
+            uint32_t a = keys[nKeys - 1].page;
+            uint32_t b = keys[i].page;
+            if (t->urlLens[a] != t->urlLens[b] 
+                || memcmp(t->urls[a], t->urls[b], t->urlLens[a]) != 0) {
+                freeLarge(keys);
+                return false;
+            }
+            continue;
+        }
+        keys[nKeys++] = keys[i];
+    }
+
+    uint32_t nSlots = nKeys;
+    uint32_t nBuckets = nSlots / URL_BUCKET_SIZE + 1;
+    uint32_t *bucketStart = calloc(nBuckets + 1, sizeof(uint32_t));
+    uint32_t *order = malloc(nBuckets * sizeof(uint32_t));
+    uint32_t *bucketKeys = allocLarge(nKeys, sizeof(uint32_t));
+    uint32_t *pilots = allocLarge(nBuckets, sizeof(uint32_t));
+    uint32_t *slotPage = allocLarge(nPages, sizeof(uint32_t));
+    bool *taken = allocLarge(nSlots, sizeof(bool));
+    memset(pilots, 0, nBuckets * sizeof(uint32_t));
+    memset(taken, 0, nSlots * sizeof(bool));
+    if (bucketStart == NULL || order == NULL) {
+        fprintf(stderr, "error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Group the keys by bucket
+    for (uint32_t i = 0; i < nKeys; i++) {
+        bucketStart[(((keys[i].hash >> 32) * nBuckets) >> 32) + 1]++;
+    }
+    uint32_t maxSize = 0;
+    for (uint32_t b = 0; b < nBuckets; b++) {
+        if (bucketStart[b + 1] > maxSize) maxSize = bucketStart[b + 1];
+        bucketStart[b + 1] += bucketStart[b];
+    }
+    uint32_t *fill = calloc(nBuckets, sizeof(uint32_t));
+    uint32_t *slots = malloc((maxSize + 1) * sizeof(uint32_t));
+    uint32_t *bySize = calloc(maxSize + 2, sizeof(uint32_t));
+    if (fill == NULL || slots == NULL || bySize == NULL) {
+        fprintf(stderr, "error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (uint32_t i = 0; i < nKeys; i++) {
+        uint32_t b = ((keys[i].hash >> 32) * nBuckets) >> 32;
+        bucketKeys[bucketStart[b] + fill[b]++] = i;
+    }
+
+    // Counting sort of the buckets by size, largest first
+    for (uint32_t b = 0; b < nBuckets; b++) {
+        bySize[maxSize - (bucketStart[b + 1] - bucketStart[b]) + 1]++;
+    }
+    for (uint32_t size = 0; size <= maxSize; size++) {
+        bySize[size + 1] += bySize[size];
+    }
+    for (uint32_t b = 0; b < nBuckets; b++) {
+        order[bySize[maxSize - (bucketStart[b + 1] - bucketStart[b])]++] = b;
+    }
+
+    bool ok = true;
+    for (uint32_t o = 0; o < nBuckets && ok; o++) {
+        uint32_t b = order[o];
+        uint32_t size = bucketStart[b + 1] - bucketStart[b];
+        if (size == 0) break;
+
+        // Find a pilot that sends every key in the bucket to a free slot
+        uint32_t pilot = 0;
+        for (; pilot < URL_PILOT_LIMIT; pilot++) {
+            uint64_t pilotHash = mix64(pilot ^ seed);
+            bool fits = true;
+            for (uint32_t k = 0; k < size && fits; k++) {
+                uint64_t h = keys[bucketKeys[bucketStart[b] + k]].hash;
+                slots[k] = ((mix64(h ^ pilotHash) & 0xffffffff) * nSlots) >> 32;
+                fits = !taken[slots[k]];
+                for (uint32_t m = 0; m < k && fits; m++) {
+                    fits = slots[m] != slots[k];
+                }
+            }
+            if (fits) break;
+        }
+        if (pilot == URL_PILOT_LIMIT) {
+            ok = false;
+            break;
+        }
+
+        pilots[b] = pilot;
+        for (uint32_t k = 0; k < size; k++) {
+            taken[slots[k]] = true;
+            slotPage[slots[k]] = keys[bucketKeys[bucketStart[b] + k]].page;
+        }
+    }
+
+    freeLarge(keys);
+    free(bucketStart);
+    free(order);
+    freeLarge(bucketKeys);
+    freeLarge(taken);
+    free(fill);
+    free(slots);
+    free(bySize);
+    if (!ok) {
+        freeLarge(pilots);
+        freeLarge(slotPage);
+        return false;
+    }
+
+    t->seed = seed;
+    t->nSlots = nSlots;
+    t->nBuckets = nBuckets;
+    t->pilots = pilots;
+    t->slotPage = slotPage;
+    return true;
+}
+
+// Loads a table saved by saveUrlTable. Returns false if the file is missing, 
+// invalid or was built for a different list of urls.
+static bool loadUrlTable(UrlTable *t, const char *path, uint64_t fingerprint) {
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) return false;
+
+    char magic[8];
+    uint64_t header[2];
+    uint32_t sizes[3];
+    bool ok = fread(magic, 1, 8, fp) == 8 
+           && memcmp(magic, URL_TABLE_MAGIC, 8) == 0
+           && fread(header, sizeof(uint64_t), 2, fp) == 2
+           && fread(sizes, sizeof(uint32_t), 3, fp) == 3
+           && header[1] == fingerprint
+           && sizes[0] == t->nPages 
+           && sizes[1] > 0 && sizes[1] <= t->nPages
+           && sizes[2] > 0;
+    if (ok) {
+        t->seed = header[0];
+        t->nSlots = sizes[1];
+        t->nBuckets = sizes[2];
+        t->pilots = allocLarge(t->nBuckets, sizeof(uint32_t));
+        t->slotPage = allocLarge(t->nSlots, sizeof(uint32_t));
+        ok = fread(t->pilots, sizeof(uint32_t), t->nBuckets, fp) 
+                == t->nBuckets
+          && fread(t->slotPage, sizeof(uint32_t), t->nSlots, fp) == t->nSlots;
+        for (uint32_t i = 0; ok && i < t->nSlots; i++) {
+            ok = t->slotPage[i] < t->nPages;
+        }
+        if (!ok) {
+            freeLarge(t->pilots);
+            freeLarge(t->slotPage);
+            t->pilots = NULL;
+            t->slotPage = NULL;
+        }
+    }
+    fclose(fp);
+    return ok;
+}
+
+// Saves the table next to the collection so later runs can skip building it
+static void saveUrlTable(const UrlTable *t, const char *path, 
+                         uint64_t fingerprint) {
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL) {
+        fprintf(stderr, "fopen: %s\n", path);
+        return;
+    }
+    uint64_t header[2] = {t->seed, fingerprint};
+    uint32_t sizes[3] = {t->nPages, t->nSlots, t->nBuckets};
+    fwrite(URL_TABLE_MAGIC, 1, 8, fp);
+    fwrite(header, sizeof(uint64_t), 2, fp);
+    fwrite(sizes, sizeof(uint32_t), 3, fp);
+    fwrite(t->pilots, sizeof(uint32_t), t->nBuckets, fp);
+    fwrite(t->slotPage, sizeof(uint32_t), t->nSlots, fp);
+
+    bool failed = ferror(fp);
+    if (fclose(fp) != 0) failed = true;
+    if (failed) {
+        fprintf(stderr, "error: failed to write %s\n", path);
+        remove(path);
+    }
+}
+
+// Frees the memory used by the url table
+static void freeUrlTable(UrlTable *t) {
+    freeLarge(t->urls);
+    freeLarge(t->urlLens);
+    freeLarge(t->pilots);
+    freeLarge(t->slotPage);
+}
+
+// Hashes len bytes of url, a word at a time
+static uint64_t hashUrl(const char *url, size_t len, uint64_t seed) {
+    uint64_t h = mix64(seed ^ (len * 0x9e3779b97f4a7c15ULL));
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, url, 8);
+        h = mix64(h ^ word);
+        url += 8;
+        len -= 8;
+    }
+    if (len > 0) {
+        uint64_t word = 0;
+        memcpy(&word, url, len);
+        h = mix64(h ^ word);
+    }
+    return h;
+}
+
+// Scrambles the bits of x (the murmur3 finaliser)
+static uint64_t mix64(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+// Orders url keys by hash, then by page so the first duplicate is kept
+static int compareKeys(const void *a, const void *b) {
+    const UrlKey *x = a;
+    const UrlKey *y = b;
+    if (x->hash != y->hash) return x->hash < y->hash ? -1 : 1;
+    return (x->page > y->page) - (x->page < y->page);
+}
+
+// Calculates page ranks for each url using the given formula
+List calculatePageRank(List l, RankGraph g, const RankConfig *rc) {
+#ifdef USE_MPI
+    if (mpiSize > 1) {
+        return calculatePageRankMpi(l, g, rc);
+    }
+#endif
+    if (rc->procs > 1 && g->nV >= (PageId)rc->procs) {
+        return calculatePageRankShared(l, g, rc);
+    }
+    double d = rc->d;
+    double N = g->nV;
+    
+    // calculate iteration 0 rank
+    double *rank = allocLarge(g->nV, sizeof(double));
+    double *prevRank = allocLarge(g->nV, sizeof(double));
+    initialiseRank(rank, g->nV, N);
+
+    // Precompute Win * Wout for each edge. The classic mode has no per-edge 
+    // coefficients, and with computedCoef or dense tiles they are worked 
+    // out as they are needed.
+    double *coef = NULL;
+    double *pageScale = NULL;
+    double *sourceScale = NULL;
+    if (rc->mode == MODE_WEIGHTED && !rc->computedCoef 
+        && rc->layout != LAYOUT_TILES) {
+        coef = setEdgeCoefficients(g, 0, g->nV);
+    } else {
+        if (rc->mode == MODE_WEIGHTED) {
+            pageScale = allocLarge(g->nV + 1, sizeof(double));
+        }
+        sourceScale = allocLarge(g->nV + 1, sizeof(double));
+        setCoefficientFactors(g, rc->mode, pageScale, sourceScale);
+    }
+
+    // prevRank is overwritten by the first iteration so calibration can use 
+    // it as scratch. Without coef the sweeps sum the sources' shares, which 
+    // is the coefficient-free kernel calibrated here. The tiled and pruned 
+    // sweeps run over a smaller graph built by the solver, so they calibrate 
+    // on that themselves, and the other layouts and the SCC solver don't 
+    // prefetch.
+    int distance = rc->prefetch;
+    if (distance == PREFETCH_AUTO && !rc->prune 
+        && rc->layout != LAYOUT_TILES) {
+        distance = rc->solver != SOLVER_SCC && rc->layout == LAYOUT_CSR 
+                 ? tunePrefetchDistance(g, coef, rank, prevRank, d, N, 
+                                        rc->stats) 
+                 : 0;
+    }
+
+    // The iteration only reads the rank, coefficient and in-link arrays. The 
+    // url list's nodes, which hold the urls and list links next to their 
+    // ranks, are only touched to copy the results back, so the cache misses 
+    // counted here are all from the hot arrays.
+    int tlbMisses = -1;
+    int l1Misses = -1;
+    int llcMisses = -1;
+    if (rc->stats) {
+        tlbMisses = perfOpen(COUNT_DTLB_MISSES);
+        l1Misses = perfOpen(COUNT_L1D_MISSES);
+        llcMisses = perfOpen(COUNT_LLC_MISSES);
+    }
+    double start = now();
+
+    int iterations = 1;
+    double diff = rc->diffPR;
+    switch (rc->solver) {
+    case SOLVER_SCC:
+        diff = solveComponents(g, coef, rank, prevRank, rc, &iterations);
+        break;
+    case SOLVER_BICGSTAB:
+        diff = solveBicgstab(g, coef, rank, rc, distance, &iterations);
+        break;
+    case SOLVER_GMRES:
+        diff = solveGmres(g, coef, rank, rc, distance, &iterations);
+        break;
+    case SOLVER_CHEBYSHEV:
+        diff = solveChebyshev(g, coef, &rank, &prevRank, rc, distance, 
+                              &iterations);
+        break;
+    case SOLVER_POWER:
+        if (rc->prune) {
+            diff = solvePruned(g, coef, rank, rc, distance, &iterations);
+            break;
+        }
+        if (rc->layout == LAYOUT_SELL) {
+            diff = solveSell(g, coef, &rank, &prevRank, rc, &iterations);
+            break;
+        }
+#ifdef USE_DEGREE_BUCKETS
+        if (rc->layout == LAYOUT_BUCKETS) {
+            diff = solveBuckets(g, coef, &rank, &prevRank, rc, &iterations);
+            break;
+        }
+#endif
+        if (rc->layout == LAYOUT_TILES) {
+            diff = solveTiled(g, pageScale, sourceScale, &rank, &prevRank, 
+                              rc, distance, &iterations);
+            break;
+        }
+        if (coef == NULL) {
+            diff = solveFactored(g, pageScale, sourceScale, &rank, 
+                                 &prevRank, rc, distance, &iterations);
+            break;
+        }
+        if (rc->hosts != HOSTS_OFF && urlsHaveHosts(l)) {
+            diff = solveWithHosts(l, g, coef, &rank, &prevRank, rc, distance, 
+                                  &iterations);
+            break;
+        }
+        if (rc->hosts != HOSTS_OFF && rc->stats) {
+            fprintf(statsStream(), "hosts: not every url starts with "
+                    "scheme://host, ranking without hosts\n");
+        }
+        for (int i = 1; i < rc->maxIterations && diff >= rc->diffPR; i++) {
+            // store the previous rank
+            double *tmp = prevRank;
+            prevRank = rank;
+            rank = tmp;
+
+            // Update the rank
+            updateRanks(g, coef, prevRank, rank, 0, g->nV, d, N, distance);
+            diff = calculateDiff(rank, prevRank, g->nV);
+            iterations++;
+        }
+        break;
+    }
+
+    if (rc->stats) {
+        double seconds = now() - start;
+        long long misses = perfRead(tlbMisses);
+        long long l1 = perfRead(l1Misses);
+        long long llc = perfRead(llcMisses);
+        fprintf(statsStream(),
+                "iterate: %d iterations in %.3fs (%.3f ms each), "
+                "diff %g", iterations - 1, seconds, 
+                iterations > 1 ? seconds * 1000 / (iterations - 1) : 0, diff);
+        if (misses >= 0) {
+            fprintf(statsStream(), ", %lld dTLB load misses", misses);
+        }
+        if (l1 >= 0) {
+            fprintf(statsStream(), ", %lld L1d load misses", l1);
+        }
+        if (llc >= 0) {
+            fprintf(statsStream(), ", %lld cache misses", llc);
+        }
+        fprintf(statsStream(), "\n");
+        if (coef != NULL) {
+            printMemoryUsage(g, sizeof(double), 0);
+        } else {
+            // The per-page factors and shares of solveFactored
+            int factors = rc->mode == MODE_CLASSIC ? 2 : 3;
+            printMemoryUsage(g, 0, factors * sizeof(double));
+        }
+    }
+
+    // Copy the results back to the url list for sorting and printing
+    for (Node n = l->head; n != NULL; n = n->next) {
+        n->rank = rank[n->index];
+        n->outDegree = g->outDegree[n->index];
+        n->inDegree = g->inDegree[n->index];
+    }
+    freeLarge(rank);
+    freeLarge(prevRank);
+    freeLarge(coef);
+    freeLarge(pageScale);
+    freeLarge(sourceScale);
+    return l;
+}
+
+// Initialises rank to 1/N for each url
+static void initialiseRank(double *rank, PageId nV, double N) {
+    for (PageId pi = 0; pi < nV; pi++) {
+        rank[pi] = 1 / N;
+    }
+}
+
+// Returns Win * Wout for the in-links of pages first .. last - 1, in the 
+// same order as g->inSrc
+static double *setEdgeCoefficients(RankGraph g, PageId first, PageId last) {
+    EdgeIndex base = g->inStart[first];
+    double *coef = allocLarge(g->inStart[last] - base + 1, sizeof(double));
+    fillEdgeCoefficients(g, first, last, coef);
+    return coef;
+}
+
+// Writes the coefficients setEdgeCoefficients returns into coef
+static void fillEdgeCoefficients(RankGraph g, PageId first, PageId last, 
+                                 double *coef) {
+    // Sum the in and out degrees of the pages each page links to. Visiting 
+    // pi in order adds them in the same order as a scan of pj's links.
+    double *inTotal = allocArray(g->nV, sizeof(double));
+    double *outTotal = allocArray(g->nV, sizeof(double));
+    memset(inTotal, 0, g->nV * sizeof(double));
+    memset(outTotal, 0, g->nV * sizeof(double));
+    for (PageId pi = 0; pi < g->nV; pi++) {
+        for (EdgeIndex e = g->inStart[pi]; e < g->inStart[pi + 1]; e++) {
+            PageId pj = g->inSrc[e];
+            inTotal[pj] += g->inDegree[pi];
+            outTotal[pj] += adjustedOutDegree(g, pi);
+        }
+    }
+
+    EdgeIndex base = g->inStart[first];
+    for (PageId pi = first; pi < last; pi++) {
+        for (EdgeIndex e = g->inStart[pi]; e < g->inStart[pi + 1]; e++) {
+            PageId pj = g->inSrc[e];
+            double Wout = calculateWout(g, outTotal, pj, pi);
+            double Win = calculateWin(g, inTotal, pj, pi);
+            coef[e - base] = Wout * Win;
+        }
+    }
+    free(inTotal);
+    free(outTotal);
+}
+
+// Calculates the Win for an edge given the total incoming links of the pages 
+// pj links to
+static double calculateWin(RankGraph g, const double *inTotal, PageId pj, 
+                           PageId pi) {
+    return g->inDegree[pi] / inTotal[pj];
+}
+
+// Calculates the Wout for an edge given the total outgoing links of the pages 
+// pj links to
+static double calculateWout(RankGraph g, const double *outTotal, PageId pj, 
+                            PageId pi) {
+    // Set to 0.5 per spec if == 0
+    double pjTotalOutgoingLinks = outTotal[pj];
+    if (pjTotalOutgoingLinks == 0) {
+        pjTotalOutgoingLinks = 0.5;
+    } 
+    return adjustedOutDegree(g, pi) / pjTotalOutgoingLinks;
+}
+
+// Returns the outgoing links of a page, set to 0.5 if it has none per spec
+static double adjustedOutDegree(RankGraph g, PageId p) {
+    if (g->outDegree[p] == 0) return 0.5;
+    return g->outDegree[p];
+}
+
+// Solves for the ranks one strongly connected component at a time, upstream 
+// components first. Every link into a component then comes from a page 
+// whose rank is already final, so those links are summed once and only the 
+// links inside the component are iterated. A component of one page has no 
+// links inside it (there are no self loops) and is solved in one step. 
+// The links inside a component are copied out with their coefficients as 
+// it is reached, so iterating it reads them in order. Each component is 
+// iterated until its diff is under its share of diffPR, so the total stays 
+// under diffPR. next is scratch. Sets *iterations to 
+// one more than the most iterations any component took, like the power 
+// loop's count, and returns the summed diff.
+static double solveComponents(RankGraph g, const double *coef, double *rank, 
+                              double *next, const RankConfig *rc, 
+                              int *iterations) {
+    double d = rc->d;
+    double N = g->nV;
+    PageId *order = allocArray(g->nV + 1, sizeof(PageId));
+    PageId *compStart = allocArray(g->nV + 1, sizeof(PageId));
+    PageId *compOf = allocArray(g->nV + 1, sizeof(PageId));
+    double *upstream = allocLarge(g->nV + 1, sizeof(double));
+    EdgeIndex *insideStart = allocLarge(g->nV + 1, sizeof(EdgeIndex));
+    PageId *insideSrc = allocLarge(g->nE + 1, sizeof(PageId));
+    double *insideCoef = allocLarge(g->nE + 1, sizeof(double));
+    double start = now();
+    PageId nComps = findComponents(g, order, compStart, compOf);
+    double findSeconds = now() - start;
+
+    unsigned long long edgeVisits = 0;
+    PageId largest = 0;
+    PageId singletons = 0;
+    int mostIterations = 0;
+    double totalDiff = 0;
+    for (PageId c = 0; c < nComps; c++) {
+        const PageId *pages = order + compStart[c];
+        PageId n = compStart[c + 1] - compStart[c];
+        if (n > largest) largest = n;
+
+        // Sum the links from upstream components once
+        EdgeIndex inside = 0;
+        for (PageId k = 0; k < n; k++) {
+            PageId pi = pages[k];
+            double weight = 0;
+            insideStart[k] = inside;
+            for (EdgeIndex e = g->inStart[pi]; e < g->inStart[pi + 1]; e++) {
+                PageId pj = g->inSrc[e];
+                if (compOf[pj] != c) {
+                    weight += rank[pj] * coef[e];
+                } else {
+                    insideSrc[inside] = pj;
+                    insideCoef[inside] = coef[e];
+                    inside++;
+                }
+            }
+            edgeVisits += g->inStart[pi + 1] - g->inStart[pi];
+            upstream[pi] = weight;
+            rank[pi] = 1 / N;
+        }
+        insideStart[n] = inside;
+        if (n == 1) {
+            rank[pages[0]] = (1 - d) / N + d * upstream[pages[0]];
+            singletons++;
+            continue;
+        }
+
+        double tolerance = rc->diffPR * n / N;
+        double diff = tolerance;
+        int i;
+        for (i = 1; i < rc->maxIterations && diff >= tolerance; i++) {
+            for (PageId k = 0; k < n; k++) {
+                PageId pi = pages[k];
+                double weight = upstream[pi];
+                for (EdgeIndex e = insideStart[k]; e < insideStart[k + 1]; 
+                     e++) {
+                    weight += rank[insideSrc[e]] * insideCoef[e];
+                }
+                next[pi] = (1 - d) / N + d * weight;
+            }
+            diff = 0;
+            for (PageId k = 0; k < n; k++) {
+                PageId pi = pages[k];
+                diff += fabs(next[pi] - rank[pi]);
+                rank[pi] = next[pi];
+            }
+            edgeVisits += inside;
+        }
+        if (i - 1 > mostIterations) mostIterations = i - 1;
+        totalDiff += diff;
+    }
+
+    if (rc->stats) {
+        fprintf(statsStream(),
+                "scc: %u components (%u single pages, largest %u) "
+                "found in %.3fs, %llu edge visits (%.2f full sweeps)\n", 
+                nComps, singletons, largest, findSeconds, edgeVisits, 
+                g->nE > 0 ? (double)edgeVisits / g->nE : 0);
+    }
+    *iterations = mostIterations + 1;
+    free(order);
+    free(compStart);
+    free(compOf);
+    freeLarge(upstream);
+    freeLarge(insideStart);
+    freeLarge(insideSrc);
+    freeLarge(insideCoef);
+    return totalDiff;
+}
+
+// Runs the power iteration on the core of the graph left after peeling off 
+// the pages that no cycle feeds. A page without in-links has rank 
+// (1 - d) / N, and a page whose in-links all come from peeled pages has a 
+// rank fixed by theirs, so these are solved in closed form in link order 
+// (Kahn's algorithm on the out-links). The core keeps only the links 
+// between core pages; the links from peeled pages are summed once into a 
+// constant per page. The ranks end up in rank in page order. A distance of 
+// PREFETCH_AUTO is calibrated on the core.
+static double solvePruned(RankGraph g, const double *coef, double *rank, 
+                          const RankConfig *rc, int distance, 
+                          int *iterations) {
+    double d = rc->d;
+    double N = g->nV;
+    double start = now();
+
+    // Out-links are needed to find the pages a peeled page frees up
+    EdgeIndex *outStart = allocLarge(g->nV + 1, sizeof(EdgeIndex));
+    PageId *outDst = allocLarge(g->nE + 1, sizeof(PageId));
+    outStart[0] = 0;
+    for (PageId p = 0; p < g->nV; p++) {
+        outStart[p + 1] = outStart[p] + g->outDegree[p];
+    }
+    for (PageId pi = 0; pi < g->nV; pi++) {
+        for (EdgeIndex e = g->inStart[pi]; e < g->inStart[pi + 1]; e++) {
+            outDst[outStart[g->inSrc[e]]++] = pi;
+        }
+    }
+    for (PageId p = g->nV; p > 0; p--) {
+        outStart[p] = outStart[p - 1];
+    }
+    outStart[0] = 0;
+
+    // Peel in rounds so the depth of the peeled part can be reported
+    uint32_t *remaining = allocArray(g->nV + 1, sizeof(uint32_t));
+    PageId *queue = allocArray(g->nV + 1, sizeof(PageId));
+    PageId *coreId = allocArray(g->nV + 1, sizeof(PageId));
+    PageId tail = 0;
+    for (PageId p = 0; p < g->nV; p++) {
+        remaining[p] = g->inDegree[p];
+        coreId[p] = 0;
+        if (remaining[p] == 0) queue[tail++] = p;
+    }
+    int levels = 0;
+    for (PageId head = 0; head < tail; levels++) {
+        PageId levelEnd = tail;
+        for (; head < levelEnd; head++) {
+            PageId pi = queue[head];
+            double weight = 0;
+            for (EdgeIndex e = g->inStart[pi]; e < g->inStart[pi + 1]; e++) {
+                weight += rank[g->inSrc[e]] * coef[e];
+            }
+            rank[pi] = (1 - d) / N + d * weight;
+            coreId[pi] = PAGE_NONE;
+            for (EdgeIndex e = outStart[pi]; e < outStart[pi + 1]; e++) {
+                if (--remaining[outDst[e]] == 0) queue[tail++] = outDst[e];
+            }
+        }
+    }
+    PageId nPeeled = tail;
+    freeLarge(outStart);
+    freeLarge(outDst);
+    free(remaining);
+    free(queue);
+
+    // Number the core pages and copy out the links between them
+    PageId nCore = 0;
+    EdgeIndex coreEdges = 0;
+    for (PageId p = 0; p < g->nV; p++) {
+        if (coreId[p] == PAGE_NONE) continue;
+        coreId[p] = nCore++;
+        for (EdgeIndex e = g->inStart[p]; e < g->inStart[p + 1]; e++) {
+            if (coreId[g->inSrc[e]] != PAGE_NONE) coreEdges++;
+        }
+    }
+    struct rankGraph core = {nCore, coreEdges, NULL, NULL, NULL, NULL};
+    core.inStart = allocLarge(nCore + 1, sizeof(EdgeIndex));
+    core.inSrc = allocLarge(coreEdges + PREFETCH_MAX_DISTANCE, 
+                            sizeof(PageId));
+    double *coreCoef = allocLarge(coreEdges + 1, sizeof(double));
+    double *constant = allocLarge(nCore + 1, sizeof(double));
+    PageId *corePage = allocArray(nCore + 1, sizeof(PageId));
+    EdgeIndex ce = 0;
+    for (PageId p = 0; p < g->nV; p++) {
+        if (coreId[p] == PAGE_NONE) continue;
+        PageId k = coreId[p];
+        corePage[k] = p;
+        core.inStart[k] = ce;
+        constant[k] = 0;
+        for (EdgeIndex e = g->inStart[p]; e < g->inStart[p + 1]; e++) {
+            PageId pj = g->inSrc[e];
+            if (coreId[pj] == PAGE_NONE) {
+                constant[k] += rank[pj] * coef[e];
+            } else {
+                core.inSrc[ce] = coreId[pj];
+                coreCoef[ce++] = coef[e];
+            }
+        }
+    }
+    core.inStart[nCore] = ce;
+    memset(&core.inSrc[coreEdges], 0, PREFETCH_MAX_DISTANCE * sizeof(PageId));
+    free(coreId);
+    double pruneSeconds = now() - start;
+
+    double *coreRank = allocLarge(nCore + 1, sizeof(double));
+    double *corePrev = allocLarge(nCore + 1, sizeof(double));
+    initialiseRank(coreRank, nCore, N);
+    if (distance == PREFETCH_AUTO) {
+        distance = tunePrefetchDistance(&core, coreCoef, coreRank, corePrev, 
+                                        d, N, rc->stats);
+    }
+    *iterations = 1;
+    double diff = rc->diffPR;
+    for (int i = 1; i < rc->maxIterations && diff >= rc->diffPR; i++) {
+        double *tmp = corePrev;
+        corePrev = coreRank;
+        coreRank = tmp;
+        updateRanks(&core, coreCoef, corePrev, coreRank, 0, nCore, d, N, 
+                    distance);
+        for (PageId k = 0; k < nCore; k++) {
+            coreRank[k] += d * constant[k];
+        }
+        diff = calculateDiff(coreRank, corePrev, nCore);
+        (*iterations)++;
+    }
+    for (PageId k = 0; k < nCore; k++) {
+        rank[corePage[k]] = coreRank[k];
+    }
+
+    if (rc->stats) {
+        double saved = (double)(*iterations - 1) * (g->nE - coreEdges);
+        fprintf(statsStream(), "prune: %u pages (%.1f%%) solved directly in %d "
+                "levels in %.3fs, core of %u pages and %llu edges, %.0f edge "
+                "visits saved (%.1f%%)\n", nPeeled, 
+                g->nV > 0 ? 100.0 * nPeeled / g->nV : 0, levels, 
+                pruneSeconds, nCore, (unsigned long long)coreEdges, saved, 
+                g->nE > 0 && *iterations > 1 
+                    ? 100.0 * saved / ((double)(*iterations - 1) * g->nE) : 0);
+    }
+    freeLarge(core.inStart);
+    freeLarge(core.inSrc);
+    freeLarge(coreCoef);
+    freeLarge(constant);
+    freeLarge(coreRank);
+    freeLarge(corePrev);
+    free(corePage);
+    return diff;
+}
+
+// Runs the power iteration from a seed built on the host-level graph, as in 
+// BlockRank. Each host's pages are ranked on the links inside the host 
+// alone, then the hosts' shares are solved for on the graph between hosts 
+// and each host's local ranks are scaled to its share. With 
+// HOSTS_TWOLEVEL the host shares are corrected again before every 
+// iteration (iterative aggregation/disaggregation), weighting the host 
+// links by the current ranks. The local sweeps and each correction's pass 
+// over the links count against maxIterations like power iterations.
+static double solveWithHosts(List l, RankGraph g, const double *coef, 
+                             double **rank, double **prevRank, 
+                             const RankConfig *rc, int distance, 
+                             int *iterations) {
+    double start = now();
+    HostGraph hg;
+    buildHostGraph(l, g, &hg);
+    // Leave room for the first correction and one power iteration
+    EdgeIndex localLinks = 0;
+    int localSweeps = seedLocalRanks(g, coef, &hg, rank, prevRank, rc, 
+                                     distance, rc->maxIterations - 3, 
+                                     &localLinks);
+    *iterations = 1 + localSweeps;
+    int hostSweeps = 0;
+    int corrections = 0;
+    if (*iterations + 1 < rc->maxIterations) {
+        hostSweeps = correctWithHosts(g, coef, &hg, *rank, rc);
+        corrections++;
+        (*iterations)++;
+    }
+    double seedSeconds = now() - start;
+
+    double diff = rc->diffPR;
+    for (int i = 1; *iterations < rc->maxIterations && diff >= rc->diffPR; 
+         i++) {
+        if (rc->hosts == HOSTS_TWOLEVEL && i > 1 
+            && *iterations + 1 < rc->maxIterations) {
+            hostSweeps += correctWithHosts(g, coef, &hg, *rank, rc);
+            corrections++;
+            (*iterations)++;
+        }
+        double *tmp = *prevRank;
+        *prevRank = *rank;
+        *rank = tmp;
+        updateRanks(g, coef, *prevRank, *rank, 0, g->nV, rc->d, g->nV, 
+                    distance);
+        diff = calculateDiff(*rank, *prevRank, g->nV);
+        (*iterations)++;
+    }
+
+    if (rc->stats) {
+        fprintf(statsStream(),
+                "hosts: %u hosts, %llu host links, %llu same-host "
+                "page links, seed from %d local sweeps in %.3fs, %d "
+                "corrections with %d host sweeps\n", hg.nHosts, 
+                (unsigned long long)hg.nLinks, 
+                (unsigned long long)localLinks, localSweeps, seedSeconds, 
+                corrections, hostSweeps);
+    }
+    freeHostGraph(&hg);
+    return diff;
+}
+
+// Returns true if every url names its host, so the host graph can be built
+static bool urlsHaveHosts(List l) {
+    for (Node n = l->head; n != NULL; n = n->next) {
+        size_t len;
+        if (urlHost(n->url, &len) == NULL) return false;
+    }
+    return true;
+}
+
+// Returns the host in url's authority and sets len to its length: the part 
+// after "scheme://" and any "user@", up to the port, path, query or 
+// fragment. Returns NULL if url doesn't start with a scheme.
+static const char *urlHost(const char *url, size_t *len) {
+    if (!isalpha((unsigned char)url[0])) return NULL;
+    size_t scheme = 1;
+    while (isalnum((unsigned char)url[scheme]) || url[scheme] == '+' 
+           || url[scheme] == '-' || url[scheme] == '.') {
+        scheme++;
+    }
+    if (strncmp(url + scheme, "://", 3) != 0) return NULL;
+
+    const char *host = url + scheme + 3;
+    size_t authority = strcspn(host, "/?#");
+    const char *at = memchr(host, '@', authority);
+    if (at != NULL) {
+        authority -= at + 1 - host;
+        host = at + 1;
+    }
+    *len = strcspn(host, ":/?#");
+    if (*len > authority) *len = authority;
+    return host;
+}
+
+// Numbers the hosts and builds the links between them. Hosts are numbered 
+// in order of their hashes, reusing the url table's hashing. Every url must 
+// have a host (see urlsHaveHosts).
+static void buildHostGraph(List l, RankGraph g, HostGraph *hg) {
+    UrlKey *keys = allocArray(g->nV + 1, sizeof(UrlKey));
+    PageId nKeys = 0;
+    for (Node n = l->head; n != NULL; n = n->next) {
+        size_t len;
+        const char *host = urlHost(n->url, &len);
+        keys[nKeys].hash = hashUrl(host, len, 0);
+        keys[nKeys].page = n->index;
+        nKeys++;
+    }
+    qsort(keys, nKeys, sizeof(UrlKey), compareKeys);
+    hg->hostOf = allocArray(g->nV + 1, sizeof(uint32_t));
+    hg->nHosts = 0;
+    for (PageId k = 0; k < nKeys; k++) {
+        if (k > 0 && keys[k].hash != keys[k - 1].hash) hg->nHosts++;
+        hg->hostOf[keys[k].page] = hg->nHosts;
+    }
+    if (nKeys > 0) hg->nHosts++;
+
+    // Pages in host order, so each host's in-links are gathered together
+    uint32_t nHosts = hg->nHosts;
+    hg->hostSize = allocArray(nHosts + 1, sizeof(uint32_t));
+    memset(hg->hostSize, 0, (nHosts + 1) * sizeof(uint32_t));
+    for (PageId p = 0; p < g->nV; p++) {
+        hg->hostSize[hg->hostOf[p]]++;
+    }
+    PageId *hostStart = allocArray(nHosts + 1, sizeof(PageId));
+    hostStart[0] = 0;
+    for (uint32_t h = 0; h < nHosts; h++) {
+        hostStart[h + 1] = hostStart[h] + hg->hostSize[h];
+    }
+    PageId *hostPages = (PageId *)keys;
+    for (PageId p = 0; p < g->nV; p++) {
+        hostPages[hostStart[hg->hostOf[p]]++] = p;
+    }
+    for (uint32_t h = nHosts; h > 0; h--) {
+        hostStart[h] = hostStart[h - 1];
+    }
+    hostStart[0] = 0;
+
+    // Count the distinct hosts linking into each host, then fill them in. 
+    // seen marks the host whose links are being gathered.
+    uint32_t *seen = allocArray(nHosts + 1, sizeof(uint32_t));
+    EdgeIndex *slot = allocArray(nHosts + 1, sizeof(EdgeIndex));
+    for (int pass = 0; pass < 2; pass++) {
+        for (uint32_t h = 0; h < nHosts; h++) {
+            seen[h] = PAGE_NONE;
+        }
+        EdgeIndex links = 0;
+        for (uint32_t J = 0; J < nHosts; J++) {
+            if (pass == 1) hg->inStart[J] = links;
+            for (PageId k = hostStart[J]; k < hostStart[J + 1]; k++) {
+                PageId pi = hostPages[k];
+                for (EdgeIndex e = g->inStart[pi]; e < g->inStart[pi + 1]; 
+                     e++) {
+                    uint32_t I = hg->hostOf[g->inSrc[e]];
+                    if (seen[I] != J) {
+                        seen[I] = J;
+                        slot[I] = links;
+                        if (pass == 1) hg->inSrc[links] = I;
+                        links++;
+                    }
+                    if (pass == 1) hg->linkOf[e] = slot[I];
+                }
+            }
+        }
+        if (pass == 0) {
+            hg->nLinks = links;
+            hg->inStart = allocArray(nHosts + 1, sizeof(EdgeIndex));
+            hg->inSrc = allocArray(links + 1, sizeof(uint32_t));
+            hg->linkOf = allocLarge(g->nE + 1, sizeof(EdgeIndex));
+        } else {
+            hg->inStart[nHosts] = links;
+        }
+    }
+    hg->weight = allocArray(hg->nLinks + 1, sizeof(double));
+    hg->mass = allocArray(nHosts + 1, sizeof(double));
+    hg->hostRank = allocArray(nHosts + 1, sizeof(double));
+    hg->hostPrev = allocArray(nHosts + 1, sizeof(double));
+    free(keys);
+    free(hostStart);
+    free(seen);
+    free(slot);
+}
+
+// Ranks every page on the links inside its own host, iterating from 1/N 
+// until the diff is under diffPR or maxSweeps have run. The links inside 
+// hosts are copied out first so each sweep only reads those. Returns the 
+// number of sweeps.
+static int seedLocalRanks(RankGraph g, const double *coef, HostGraph *hg, 
+                          double **rank, double **prevRank, 
+                          const RankConfig *rc, int distance, int maxSweeps, 
+                          EdgeIndex *localLinks) {
+    EdgeIndex nLocal = 0;
+    for (PageId pi = 0; pi < g->nV; pi++) {
+        for (EdgeIndex e = g->inStart[pi]; e < g->inStart[pi + 1]; e++) {
+            if (hg->hostOf[g->inSrc[e]] == hg->hostOf[pi]) nLocal++;
+        }
+    }
+    struct rankGraph local = {g->nV, nLocal, NULL, NULL, NULL, NULL};
+    local.inStart = allocLarge(g->nV + 1, sizeof(EdgeIndex));
+    local.inSrc = allocLarge(nLocal + PREFETCH_MAX_DISTANCE, sizeof(PageId));
+    double *localCoef = allocLarge(nLocal + 1, sizeof(double));
+    EdgeIndex le = 0;
+    for (PageId pi = 0; pi < g->nV; pi++) {
+        local.inStart[pi] = le;
+        for (EdgeIndex e = g->inStart[pi]; e < g->inStart[pi + 1]; e++) {
+            if (hg->hostOf[g->inSrc[e]] == hg->hostOf[pi]) {
+                local.inSrc[le] = g->inSrc[e];
+                localCoef[le++] = coef[e];
+            }
+        }
+    }
+    local.inStart[g->nV] = le;
+    memset(&local.inSrc[nLocal], 0, PREFETCH_MAX_DISTANCE * sizeof(PageId));
+
+    int sweeps = 0;
+    double diff = rc->diffPR;
+    while (sweeps < maxSweeps && diff >= rc->diffPR) {
+        double *tmp = *prevRank;
+        *prevRank = *rank;
+        *rank = tmp;
+        updateRanks(&local, localCoef, *prevRank, *rank, 0, g->nV, rc->d, 
+                    g->nV, distance);
+        diff = calculateDiff(*rank, *prevRank, g->nV);
+        sweeps++;
+    }
+    *localLinks = nLocal;
+    freeLarge(local.inStart);
+    freeLarge(local.inSrc);
+    freeLarge(localCoef);
+    return sweeps;
+}
+
+// Scales the ranks on each host so the hosts' totals solve the host-level 
+// system. A host link's weight is the sum of its page links' coefficients, 
+// each weighted by its source's share of the source host's total, so the 
+// totals are exact when the ranks are spread over each host's pages in the 
+// right proportions. The host system is iterated from the current totals 
+// to a tenth of diffPR, so its error stays below the page-level test. 
+// Returns the number of host sweeps.
+static int correctWithHosts(RankGraph g, const double *coef, HostGraph *hg, 
+                            double *rank, const RankConfig *rc) {
+    double d = rc->d;
+    double N = g->nV;
+    uint32_t nHosts = hg->nHosts;
+    memset(hg->mass, 0, nHosts * sizeof(double));
+    memset(hg->weight, 0, hg->nLinks * sizeof(double));
+    for (PageId pi = 0; pi < g->nV; pi++) {
+        hg->mass[hg->hostOf[pi]] += rank[pi];
+        for (EdgeIndex e = g->inStart[pi]; e < g->inStart[pi + 1]; e++) {
+            hg->weight[hg->linkOf[e]] += coef[e] * rank[g->inSrc[e]];
+        }
+    }
+    for (EdgeIndex c = 0; c < hg->nLinks; c++) {
+        double mass = hg->mass[hg->inSrc[c]];
+        hg->weight[c] = mass > 0 ? hg->weight[c] / mass : 0;
+    }
+
+    double *hostRank = hg->hostRank;
+    double *hostPrev = hg->hostPrev;
+    memcpy(hostRank, hg->mass, nHosts * sizeof(double));
+    int sweeps = 0;
+    double diff = rc->diffPR;
+    while (sweeps < rc->maxIterations && diff >= rc->diffPR / 10) {
+        double *tmp = hostPrev;
+        hostPrev = hostRank;
+        hostRank = tmp;
+        diff = 0;
+        for (uint32_t J = 0; J < nHosts; J++) {
+            double weight = 0;
+            for (EdgeIndex c = hg->inStart[J]; c < hg->inStart[J + 1]; c++) {
+                weight += hg->weight[c] * hostPrev[hg->inSrc[c]];
+            }
+            hostRank[J] = (1 - d) * hg->hostSize[J] / N + d * weight;
+            diff += fabs(hostRank[J] - hostPrev[J]);
+        }
+        sweeps++;
+    }
+
+    for (PageId p = 0; p < g->nV; p++) {
+        uint32_t h = hg->hostOf[p];
+        if (hg->mass[h] > 0) {
+            rank[p] *= hostRank[h] / hg->mass[h];
+        } else {
+            rank[p] = hostRank[h] / hg->hostSize[h];
+        }
+    }
+    return sweeps;
+}
+
+// Frees the host-level graph
+static void freeHostGraph(HostGraph *hg) {
+    free(hg->hostOf);
+    free(hg->hostSize);
+    free(hg->inStart);
+    free(hg->inSrc);
+    freeLarge(hg->linkOf);
+    free(hg->weight);
+    free(hg->mass);
+    free(hg->hostRank);
+    free(hg->hostPrev);
+}
+
+// The ranks solve the linear system (I - dA) x = (1 - d) / N, where A holds 
+// the edge coefficients. Its residual r = (1 - d) / N - (I - dA) x is also 
+// what one power iteration step would add to x, so stopping when |r|_1 is 
+// under diffPR matches the power iteration's diff test. The Krylov solvers 
+// count operator applications against maxIterations, one per power 
+// iteration step.
+
+// Solves for the ranks with BiCGSTAB, starting from 1/N. Each step applies 
+// the operator twice. The recurrence's residual drifts from the true one, 
+// so convergence is confirmed with a true residual before stopping. When an 
+// inner product the step divides by is near zero the recurrence restarts 
+// with rHat set to the residual, and if that breaks down again before a 
+// step completes it finishes with the power iteration.
+static double solveBicgstab(RankGraph g, const double *coef, double *rank, 
+                            const RankConfig *rc, int distance, 
+                            int *iterations) {
+    PageId n = g->nV;
+    double d = rc->d;
+    double *r = allocLarge(n + 1, sizeof(double));
+    double *rHat = allocLarge(n + 1, sizeof(double));
+    double *p = allocLarge(n + 1, sizeof(double));
+    double *v = allocLarge(n + 1, sizeof(double));
+    double *s = allocLarge(n + 1, sizeof(double));
+    double *t = allocLarge(n + 1, sizeof(double));
+
+    int applications = 1;
+    double diff = getResidual(g, coef, rank, r, d, distance);
+    memcpy(rHat, r, n * sizeof(double));
+    memset(p, 0, n * sizeof(double));
+    memset(v, 0, n * sizeof(double));
+    double rHatNorm = sqrt(dotProduct(rHat, rHat, n));
+    double rho = 1;
+    double alpha = 1;
+    double omega = 1;
+    int restarts = 0;
+    bool fresh = true;
+    bool fellBack = false;
+    while (diff >= rc->diffPR && applications + 2 < rc->maxIterations) {
+        // |r|_2 <= |r|_1, so scaling by diff errs towards restarting
+        double rhoNext = dotProduct(rHat, r, n);
+        if (omega == 0 || breaksDown(rhoNext, rHatNorm * diff)) {
+            if (fresh) {
+                fellBack = true;
+                break;
+            }
+            // Restart the recurrence from the current residual
+            memcpy(rHat, r, n * sizeof(double));
+            memset(p, 0, n * sizeof(double));
+            memset(v, 0, n * sizeof(double));
+            rHatNorm = sqrt(dotProduct(rHat, rHat, n));
+            rho = alpha = omega = 1;
+            restarts++;
+            fresh = true;
+            continue;
+        }
+        double beta = (rhoNext / rho) * (alpha / omega);
+        rho = rhoNext;
+        for (PageId i = 0; i < n; i++) {
+            p[i] = r[i] + beta * (p[i] - omega * v[i]);
+        }
+        applyOperator(g, coef, p, v, d, distance);
+        applications++;
+        double rv = dotProduct(rHat, v, n);
+        alpha = rho / rv;
+        if (breaksDown(rv, rHatNorm * sqrt(dotProduct(v, v, n))) 
+            || !isfinite(alpha)) {
+            // Leave x and r as they are and restart on the next pass
+            omega = 0;
+            continue;
+        }
+        double sNorm = 0;
+        for (PageId i = 0; i < n; i++) {
+            s[i] = r[i] - alpha * v[i];
+            sNorm += fabs(s[i]);
+        }
+        if (sNorm < rc->diffPR) {
+            for (PageId i = 0; i < n; i++) {
+                rank[i] += alpha * p[i];
+            }
+        } else {
+            applyOperator(g, coef, s, t, d, distance);
+            applications++;
+            double tt = dotProduct(t, t, n);
+            omega = tt > 0 ? dotProduct(t, s, n) / tt : 0;
+            if (!isfinite(omega)) omega = 0;
+            for (PageId i = 0; i < n; i++) {
+                rank[i] += alpha * p[i] + omega * s[i];
+                r[i] = s[i] - omega * t[i];
+            }
+        }
+        fresh = false;
+        diff = 0;
+        for (PageId i = 0; i < n; i++) {
+            diff += fabs(r[i]);
+        }
+        if (sNorm < rc->diffPR || diff < rc->diffPR) {
+            diff = getResidual(g, coef, rank, r, d, distance);
+            applications++;
+        }
+    }
+
+    // x is only moved by completed steps, so the power iteration can take 
+    // over from it with t as scratch
+    int powerSteps = 0;
+    if (fellBack) {
+        while (diff >= rc->diffPR && applications < rc->maxIterations) {
+            updateRanks(g, coef, rank, t, 0, n, d, n, distance);
+            diff = calculateDiff(t, rank, n);
+            memcpy(rank, t, n * sizeof(double));
+            applications++;
+            powerSteps++;
+        }
+    }
+
+    if (rc->stats) {
+        fprintf(statsStream(),
+                "bicgstab: %d operator applications, %d restarts, "
+                "residual %g", applications, restarts, diff);
+        if (fellBack) {
+            fprintf(statsStream(), ", broke down and fell back to %d "
+                    "power iterations", powerSteps);
+        }
+        fprintf(statsStream(), "\n");
+    }
+    *iterations = applications;
+    freeLarge(r);
+    freeLarge(rHat);
+    freeLarge(p);
+    freeLarge(v);
+    freeLarge(s);
+    freeLarge(t);
+    return diff;
+}
+
+// Solves for the ranks with GMRES restarted every GMRES_RESTART steps, 
+// starting from 1/N. GMRES minimises the 2-norm of the residual, and 
+// |r|_1 <= sqrt(N) |r|_2, so a cycle ends early once that bound is under 
+// diffPR. Each restart takes the true residual and tests its 1-norm.
+static double solveGmres(RankGraph g, const double *coef, double *rank, 
+                         const RankConfig *rc, int distance, int *iterations) {
+    PageId n = g->nV;
+    double d = rc->d;
+    int m = GMRES_RESTART;
+    double *basis = allocLarge((size_t)(m + 1) * n + 1, sizeof(double));
+    double *w = allocLarge(n + 1, sizeof(double));
+    double h[GMRES_RESTART + 1][GMRES_RESTART];
+    double cs[GMRES_RESTART];
+    double sn[GMRES_RESTART];
+    double e[GMRES_RESTART + 1];
+    double y[GMRES_RESTART];
+
+    int applications = 1;
+    int cycles = 0;
+    double diff = getResidual(g, coef, rank, basis, d, distance);
+    while (diff >= rc->diffPR && applications < rc->maxIterations) {
+        double beta = sqrt(dotProduct(basis, basis, n));
+        if (beta == 0) break;
+        for (PageId i = 0; i < n; i++) {
+            basis[i] /= beta;
+        }
+        memset(e, 0, sizeof(e));
+        e[0] = beta;
+
+        // Arnoldi with modified Gram-Schmidt, reducing h to upper 
+        // triangular with Givens rotations as it grows
+        int k = 0;
+        while (k < m && applications < rc->maxIterations) {
+            double *vk = basis + (size_t)k * n;
+            applyOperator(g, coef, vk, w, d, distance);
+            applications++;
+            for (int j = 0; j <= k; j++) {
+                double *vj = basis + (size_t)j * n;
+                h[j][k] = dotProduct(w, vj, n);
+                for (PageId i = 0; i < n; i++) {
+                    w[i] -= h[j][k] * vj[i];
+                }
+            }
+            h[k + 1][k] = sqrt(dotProduct(w, w, n));
+            for (int j = 0; j < k; j++) {
+                double hj = h[j][k];
+                h[j][k] = cs[j] * hj + sn[j] * h[j + 1][k];
+                h[j + 1][k] = -sn[j] * hj + cs[j] * h[j + 1][k];
+            }
+            double r = hypot(h[k][k], h[k + 1][k]);
+            cs[k] = r > 0 ? h[k][k] / r : 1;
+            sn[k] = r > 0 ? h[k + 1][k] / r : 0;
+            double hNext = h[k + 1][k];
+            h[k][k] = r;
+            h[k + 1][k] = 0;
+            e[k + 1] = -sn[k] * e[k];
+            e[k] = cs[k] * e[k];
+            k++;
+            if (hNext == 0 || fabs(e[k]) * sqrt((double)n) < rc->diffPR) {
+                break;
+            }
+            double *vNext = basis + (size_t)k * n;
+            for (PageId i = 0; i < n; i++) {
+                vNext[i] = w[i] / hNext;
+            }
+        }
+
+        // Solve the triangular system and update the ranks
+        for (int j = k - 1; j >= 0; j--) {
+            y[j] = e[j];
+            for (int l = j + 1; l < k; l++) {
+                y[j] -= h[j][l] * y[l];
+            }
+            y[j] /= h[j][j];
+        }
+        for (int j = 0; j < k; j++) {
+            const double *vj = basis + (size_t)j * n;
+            for (PageId i = 0; i < n; i++) {
+                rank[i] += y[j] * vj[i];
+            }
+        }
+        diff = getResidual(g, coef, rank, basis, d, distance);
+        applications++;
+        cycles++;
+    }
+
+    if (rc->stats) {
+        fprintf(statsStream(),
+                "gmres: %d operator applications in %d cycles of up "
+                "to %d, residual %g\n", applications, cycles, m, diff);
+    }
+    *iterations = applications;
+    freeLarge(basis);
+    freeLarge(w);
+    return diff;
+}
+
+// Runs the power iteration with Chebyshev acceleration. Each step takes a 
+// power step y = (1 - d) / N + dA x, whose distance from x is the same diff 
+// the power iteration tests, then moves to x' = x_old + w (y - x_old). The 
+// weights w come from rho, a bound on how fast the plain iteration 
+// contracts. d is such a bound, but the weighted coefficients usually 
+// contract much faster, so rho is the diff ratio over the last of 
+// CHEBYSHEV_WARMUP plain steps, capped at d. If the diff ever grows, the 
+// spectrum isn't the real interval Chebyshev assumes, and the remaining 
+// steps fall back to the plain iteration (w = 1).
+static double solveChebyshev(RankGraph g, const double *coef, double **rank, 
+                             double **prevRank, const RankConfig *rc, 
+                             int distance, int *iterations) {
+    double d = rc->d;
+    double *x = *rank;
+    double *xOld = *prevRank;
+    double *y = allocLarge(g->nV + 1, sizeof(double));
+    double *latest = x;
+    double rho = d;
+    double omega = 1;
+    double lastDiff = INFINITY;
+    int steps = 0;
+    int fallback = 0;
+
+    *iterations = 1;
+    double diff = rc->diffPR;
+    for (int i = 1; i < rc->maxIterations && diff >= rc->diffPR; i++) {
+        updateRanks(g, coef, x, y, 0, g->nV, d, g->nV, distance);
+        diff = calculateDiff(y, x, g->nV);
+        latest = y;
+        (*iterations)++;
+
+        // The last warmup step doubles as the first Chebyshev step, which 
+        // is a plain one
+        if (i <= CHEBYSHEV_WARMUP || fallback > 0) {
+            if (i == CHEBYSHEV_WARMUP && lastDiff > 0) {
+                rho = fmin(d, diff / lastDiff);
+                steps = 1;
+            }
+            omega = 1;
+        } else if (diff > lastDiff) {
+            fallback = i;
+            omega = 1;
+        } else {
+            omega = steps == 1 ? 2 / (2 - rho * rho) 
+                               : 1 / (1 - rho * rho * omega / 4);
+            steps++;
+        }
+        lastDiff = diff;
+        if (diff < rc->diffPR) break;
+
+        // x_old becomes the next iterate and x the one before it
+        for (PageId p = 0; p < g->nV; p++) {
+            xOld[p] += omega * (y[p] - xOld[p]);
+        }
+        double *tmp = xOld;
+        xOld = x;
+        x = tmp;
+        latest = x;
+    }
+
+    if (rc->stats) {
+        fprintf(statsStream(), "chebyshev: rho %.4f (d %.4f), ", rho, d);
+        if (fallback > 0) {
+            fprintf(statsStream(),
+                    "diff grew at iteration %d, fell back to the "
+                    "power iteration\n", fallback);
+        } else {
+            fprintf(statsStream(), "%d accelerated steps\n", steps);
+        }
+    }
+    // Hand back the latest iterate in rank and free one of the others
+    *rank = latest;
+    *prevRank = latest == x ? xOld : x;
+    freeLarge(latest == y ? xOld : y);
+    return diff;
+}
+
+// Runs the power iteration without per-edge coefficients, for when an 
+// edge's coefficient is a product pageScale[pi] * sourceScale[pj]. Each 
+// page's share prevRank[pj] * sourceScale[pj] is worked out once per 
+// iteration, then the sweep over the in-links sums the shares with no 
+// coefficients (coef == NULL), reading 4 bytes per edge instead of 12, and 
+// scales the sum by pageScale[pi] unless it is NULL.
+static double solveFactored(RankGraph g, const double *pageScale, 
+                            const double *sourceScale, double **rank, 
+                            double **prevRank, const RankConfig *rc, 
+                            int distance, int *iterations) {
+    double d = rc->d;
+    double N = g->nV;
+    double *share = allocLarge(g->nV + 1, sizeof(double));
+
+    *iterations = 1;
+    double diff = rc->diffPR;
+    for (int i = 1; i < rc->maxIterations && diff >= rc->diffPR; i++) {
+        double *tmp = *prevRank;
+        *prevRank = *rank;
+        *rank = tmp;
+        for (PageId p = 0; p < g->nV; p++) {
+            share[p] = (*prevRank)[p] * sourceScale[p];
+        }
+        if (pageScale == NULL) {
+            updateRanks(g, NULL, share, *rank, 0, g->nV, d, N, distance);
+        } else {
+            for (PageId pi = 0; pi < g->nV; pi++) {
+                double weights = distance > 0 
+                    ? getPageWeightPrefetch(g, NULL, share, pi, distance) 
+                    : getPageWeight(g, NULL, share, pi);
+                (*rank)[pi] = (1 - d) / N + d * pageScale[pi] * weights;
+            }
+        }
+        diff = calculateDiff(*rank, *prevRank, g->nV);
+        (*iterations)++;
+    }
+    freeLarge(share);
+    return diff;
+}
+
+// Runs the power iteration on a SELL-C-sigma copy of the in-links. The 
+// chunk's lanes are independent, so the inner loop over them can be 
+// vectorised with gathers. Padding adds zero coefficients after a page's 
+// in-links, which leaves its sums the same as the CSR sweep's.
+static double solveSell(RankGraph g, const double *coef, double **rank, 
+                        double **prevRank, const RankConfig *rc, 
+                        int *iterations) {
+    double start = now();
+    SellMatrix m;
+    buildSellMatrix(g, coef, &m);
+    double buildSeconds = now() - start;
+
+    *iterations = 1;
+    double diff = rc->diffPR;
+    for (int i = 1; i < rc->maxIterations && diff >= rc->diffPR; i++) {
+        double *tmp = *prevRank;
+        *prevRank = *rank;
+        *rank = tmp;
+        updateRanksSell(&m, *prevRank, *rank, rc->d, g->nV);
+        diff = calculateDiff(*rank, *prevRank, g->nV);
+        (*iterations)++;
+    }
+
+    if (rc->stats) {
+        EdgeIndex entries = m.chunkStart[m.nChunks];
+        fprintf(statsStream(),
+                "sell: C %d, sigma %d, %u chunks, %llu entries for "
+                "%llu edges (%.1f%% padding), built in %.3fs\n", SELL_CHUNK, 
+                SELL_SIGMA, m.nChunks, (unsigned long long)entries, 
+                (unsigned long long)g->nE, 
+                entries > 0 ? 100.0 * (entries - g->nE) / entries : 0, 
+                buildSeconds);
+    }
+    free(m.page);
+    free(m.chunkStart);
+    freeLarge(m.src);
+    freeLarge(m.coef);
+    return diff;
+}
+
+// Copies the in-links and their coefficients into SELL-C-sigma form
+static void buildSellMatrix(RankGraph g, const double *coef, SellMatrix *m) {
+    PageId nChunks = (g->nV + SELL_CHUNK - 1) / SELL_CHUNK;
+    m->nChunks = nChunks;
+    m->page = allocArray((size_t)nChunks * SELL_CHUNK + 1, sizeof(PageId));
+    m->chunkStart = allocArray(nChunks + 1, sizeof(EdgeIndex));
+
+    // Sort each window by in-degree, longest first, so each chunk holds 
+    // pages of about the same in-degree
+    DegreeKey *keys = allocArray(g->nV + 1, sizeof(DegreeKey));
+    for (PageId p = 0; p < g->nV; p++) {
+        keys[p].degree = g->inStart[p + 1] - g->inStart[p];
+        keys[p].page = p;
+    }
+    for (PageId w = 0; w < g->nV; w += SELL_SIGMA) {
+        PageId n = g->nV - w < SELL_SIGMA ? g->nV - w : SELL_SIGMA;
+        qsort(&keys[w], n, sizeof(DegreeKey), compareDegreeKeys);
+    }
+
+    EdgeIndex entries = 0;
+    for (PageId c = 0; c < nChunks; c++) {
+        m->chunkStart[c] = entries;
+        uint32_t width = 0;
+        for (int k = 0; k < SELL_CHUNK; k++) {
+            PageId slot = c * SELL_CHUNK + k;
+            if (slot < g->nV) {
+                m->page[slot] = keys[slot].page;
+                if (keys[slot].degree > width) width = keys[slot].degree;
+            } else {
+                m->page[slot] = PAGE_NONE;
+            }
+        }
+        entries += (EdgeIndex)width * SELL_CHUNK;
+    }
+    m->chunkStart[nChunks] = entries;
+    free(keys);
+
+    m->src = allocLarge(entries + 1, sizeof(PageId));
+    m->coef = allocLarge(entries + 1, sizeof(double));
+    for (PageId c = 0; c < nChunks; c++) {
+        EdgeIndex base = m->chunkStart[c];
+        EdgeIndex width = (m->chunkStart[c + 1] - base) / SELL_CHUNK;
+        for (int k = 0; k < SELL_CHUNK; k++) {
+            PageId p = m->page[c * SELL_CHUNK + k];
+            EdgeIndex j = 0;
+            if (p != PAGE_NONE) {
+                for (EdgeIndex e = g->inStart[p]; e < g->inStart[p + 1]; 
+                     e++, j++) {
+                    m->src[base + j * SELL_CHUNK + k] = g->inSrc[e];
+                    m->coef[base + j * SELL_CHUNK + k] = coef[e];
+                }
+            }
+            for (; j < width; j++) {
+                m->src[base + j * SELL_CHUNK + k] = 0;
+                m->coef[base + j * SELL_CHUNK + k] = 0;
+            }
+        }
+    }
+}
+
+// Calculates every page's rank from the previous ranks, a chunk at a time
+static void updateRanksSell(const SellMatrix *m, const double *prevRank, 
+                            double *rank, double d, double N) {
+    for (PageId c = 0; c < m->nChunks; c++) {
+        double sums[SELL_CHUNK] = {0};
+        EdgeIndex base = m->chunkStart[c];
+        EdgeIndex width = (m->chunkStart[c + 1] - base) / SELL_CHUNK;
+        const PageId *src = m->src + base;
+        const double *coef = m->coef + base;
+        for (EdgeIndex j = 0; j < width; j++) {
+            for (int k = 0; k < SELL_CHUNK; k++) {
+                sums[k] += prevRank[src[k]] * coef[k];
+            }
+            src += SELL_CHUNK;
+            coef += SELL_CHUNK;
+        }
+        for (int k = 0; k < SELL_CHUNK; k++) {
+            PageId p = m->page[c * SELL_CHUNK + k];
+            if (p != PAGE_NONE) rank[p] = (1 - d) / N + d * sums[k];
+        }
+    }
+}
+
+#ifdef USE_DEGREE_BUCKETS
+
+// Runs the power iteration with the pages grouped by in-degree, so each 
+// group runs a kernel specialised for its in-degrees and the loop over a 
+// page's in-links doesn't branch on its length. With stats the time spent 
+// in each bucket is reported. This is experimental and only built with 
+// USE_DEGREE_BUCKETS: reaching the pages through the bucket lists costs 
+// more than the branches it saves, and it has run slower than the CSR 
+// sweep on every collection measured.
+static double solveBuckets(RankGraph g, const double *coef, double **rank, 
+                           double **prevRank, const RankConfig *rc, 
+                           int *iterations) {
+    DegreeBuckets b;
+    buildDegreeBuckets(g, &b);
+
+    *iterations = 1;
+    double diff = rc->diffPR;
+    for (int i = 1; i < rc->maxIterations && diff >= rc->diffPR; i++) {
+        double *tmp = *prevRank;
+        *prevRank = *rank;
+        *rank = tmp;
+        updateRanksBuckets(g, coef, *prevRank, *rank, &b, rc->d, g->nV, 
+                           rc->stats);
+        diff = calculateDiff(*rank, *prevRank, g->nV);
+        (*iterations)++;
+    }
+
+    if (rc->stats && *iterations > 1) {
+        static const char *names[DEGREE_BUCKETS] = {
+            "0", "1", "2", "3", "4", "5-255", "256+"
+        };
+        for (int k = 0; k < DEGREE_BUCKETS; k++) {
+            double ms = b.seconds[k] * 1000 / (*iterations - 1);
+            fprintf(statsStream(),
+                    "bucket %s: %u pages, %llu links, %.3f ms per "
+                    "iteration (%.2f ns/link)\n", names[k], 
+                    b.start[k + 1] - b.start[k], 
+                    (unsigned long long)b.links[k], ms, 
+                    b.links[k] > 0 ? ms * 1e6 / b.links[k] : 0);
+        }
+    }
+    free(b.pages);
+    return diff;
+}
+
+// Sorts the pages into their buckets, keeping page order within each
+static void buildDegreeBuckets(RankGraph g, DegreeBuckets *b) {
+    PageId count[DEGREE_BUCKETS] = {0};
+    uint8_t *bucketOf = allocArray(g->nV + 1, sizeof(uint8_t));
+    memset(b->links, 0, sizeof(b->links));
+    memset(b->seconds, 0, sizeof(b->seconds));
+    for (PageId p = 0; p < g->nV; p++) {
+        EdgeIndex degree = g->inStart[p + 1] - g->inStart[p];
+        int k = degree <= 4 ? (int)degree 
+              : degree < BUCKET_LARGE_MIN ? 5 : 6;
+        bucketOf[p] = k;
+        count[k]++;
+        b->links[k] += degree;
+    }
+    b->start[0] = 0;
+    for (int k = 0; k < DEGREE_BUCKETS; k++) {
+        b->start[k + 1] = b->start[k] + count[k];
+        count[k] = b->start[k];
+    }
+    b->pages = allocArray(g->nV + 1, sizeof(PageId));
+    for (PageId p = 0; p < g->nV; p++) {
+        b->pages[count[bucketOf[p]]++] = p;
+    }
+    free(bucketOf);
+}
+
+// Defines updateDegreeN for the pages with exactly N in-links, with the 
+// sum over the in-links written out. The terms are added in link order, 
+// as getPageWeight adds them, so the ranks come out the same.
+#define LINK_WEIGHT(k) (prevRank[src[k]] * weights[k])
+#define DEGREE_KERNEL(N, SUM) \
+    static void updateDegree##N(RankGraph g, const double *coef, \
+                                const double *prevRank, double *rank, \
+                                const PageId *pages, PageId count, \
+                                double d, double base) { \
+        for (PageId k = 0; k < count; k++) { \
+            PageId pi = pages[k]; \
+            const PageId *src = &g->inSrc[g->inStart[pi]]; \
+            const double *weights = &coef[g->inStart[pi]]; \
+            rank[pi] = base + d * (SUM); \
+        } \
+    }
+
+DEGREE_KERNEL(1, LINK_WEIGHT(0))
+DEGREE_KERNEL(2, LINK_WEIGHT(0) + LINK_WEIGHT(1))
+DEGREE_KERNEL(3, LINK_WEIGHT(0) + LINK_WEIGHT(1) + LINK_WEIGHT(2))
+DEGREE_KERNEL(4, LINK_WEIGHT(0) + LINK_WEIGHT(1) + LINK_WEIGHT(2) 
+                 + LINK_WEIGHT(3))
+
+#undef DEGREE_KERNEL
+#undef LINK_WEIGHT
+
+// Calculates the ranks of every page, a bucket at a time, adding the time 
+// spent in each bucket to b->seconds if timed is set
+static void updateRanksBuckets(RankGraph g, const double *coef, 
+                               const double *prevRank, double *rank, 
+                               DegreeBuckets *b, double d, double N, 
+                               bool timed) {
+    double base = (1 - d) / N;
+    for (int k = 0; k < DEGREE_BUCKETS; k++) {
+        const PageId *pages = &b->pages[b->start[k]];
+        PageId count = b->start[k + 1] - b->start[k];
+        double start = timed ? now() : 0;
+        switch (k) {
+        case 0:
+            for (PageId i = 0; i < count; i++) {
+                rank[pages[i]] = base;
+            }
+            break;
+        case 1:
+            updateDegree1(g, coef, prevRank, rank, pages, count, d, base);
+            break;
+        case 2:
+            updateDegree2(g, coef, prevRank, rank, pages, count, d, base);
+            break;
+        case 3:
+            updateDegree3(g, coef, prevRank, rank, pages, count, d, base);
+            break;
+        case 4:
+            updateDegree4(g, coef, prevRank, rank, pages, count, d, base);
+            break;
+        case 5:
+            for (PageId i = 0; i < count; i++) {
+                double weights = getPageWeight(g, coef, prevRank, pages[i]);
+                rank[pages[i]] = base + d * weights;
+            }
+            break;
+        default:
+            for (PageId i = 0; i < count; i++) {
+                double weights = getPageWeightSplit(g, coef, prevRank, 
+                                                    pages[i]);
+                rank[pages[i]] = base + d * weights;
+            }
+            break;
+        }
+        if (timed) b->seconds[k] += now() - start;
+    }
+}
+
+// Calculates the page weight with four scalar accumulators instead of one, 
+// so the additions for a long list of in-links don't wait on each other. 
+// It is not written with SIMD instructions; whether the compiler vectorises 
+// the gathers through inSrc depends on the target. The sums are added in a different order 
+// from getPageWeight, so the weight may differ in its last bits.
+static double getPageWeightSplit(RankGraph g, const double *coef, 
+                                 const double *prevRank, PageId pi) {
+    double sums[4] = {0, 0, 0, 0};
+    EdgeIndex e = g->inStart[pi];
+    EdgeIndex end = g->inStart[pi + 1];
+    for (; e + 4 <= end; e += 4) {
+        for (int k = 0; k < 4; k++) {
+            sums[k] += prevRank[g->inSrc[e + k]] * coef[e + k];
+        }
+    }
+    for (; e < end; e++) {
+        sums[0] += prevRank[g->inSrc[e]] * coef[e];
+    }
+    return (sums[0] + sums[1]) + (sums[2] + sums[3]);
+}
+
+#endif
+
+// Runs the power iteration with the dense parts of the graph kept as 
+// bitmaps. A bitmap has no room for coefficients, so this uses the per-page 
+// factors of solveFactored: each page's share is worked out once, the 
+// sparse links and the tiles sum the shares, and the sum is scaled by 
+// pageScale[pi]. A tile row walks the set bits of its word, reading the 
+// shares of one source block, which stay in cache across the block's rows. 
+// The sums are added in a different order from the CSR sweep, so ranks may 
+// differ in their last bits. A distance of PREFETCH_AUTO is calibrated on 
+// the sparse links.
+static double solveTiled(RankGraph g, const double *pageScale, 
+                         const double *sourceScale, double **rank, 
+                         double **prevRank, const RankConfig *rc, 
+                         int distance, int *iterations) {
+    double d = rc->d;
+    double N = g->nV;
+    double start = now();
+    TiledGraph t;
+    buildTiledGraph(g, &t);
+    double buildSeconds = now() - start;
+
+    // Shares past the last page are left at 0 for the last block's tiles
+    size_t padded = (size_t)t.nBlocks * TILE_SIZE;
+    double *share = allocLarge(padded + 1, sizeof(double));
+    memset(share, 0, (padded + 1) * sizeof(double));
+    if (distance == PREFETCH_AUTO) {
+        distance = tunePrefetchDistance(&t.sparse, NULL, share, *prevRank, 
+                                        d, N, rc->stats);
+    }
+
+    *iterations = 1;
+    double diff = rc->diffPR;
+    for (int i = 1; i < rc->maxIterations && diff >= rc->diffPR; i++) {
+        double *tmp = *prevRank;
+        *prevRank = *rank;
+        *rank = tmp;
+        double *next = *rank;
+        for (PageId p = 0; p < g->nV; p++) {
+            share[p] = (*prevRank)[p] * sourceScale[p];
+        }
+        for (PageId pi = 0; pi < g->nV; pi++) {
+            next[pi] = distance > 0 
+                ? getPageWeightPrefetch(&t.sparse, NULL, share, pi, distance) 
+                : getPageWeight(&t.sparse, NULL, share, pi);
+        }
+        for (PageId row = 0; row < t.nBlocks; row++) {
+            PageId first = row * TILE_SIZE;
+            PageId rows = g->nV - first < TILE_SIZE ? g->nV - first 
+                                                    : TILE_SIZE;
+            for (PageId k = t.tileStart[row]; k < t.tileStart[row + 1]; k++) {
+                const uint64_t *bits = &t.bits[(size_t)k * TILE_SIZE];
+                const double *src = &share[(size_t)t.tileCol[k] * TILE_SIZE];
+                for (PageId r = 0; r < rows; r++) {
+                    double sum = 0;
+                    for (uint64_t w = bits[r]; w != 0; w &= w - 1) {
+                        sum += src[__builtin_ctzll(w)];
+                    }
+                    next[first + r] += sum;
+                }
+            }
+        }
+        for (PageId pi = 0; pi < g->nV; pi++) {
+            double scale = pageScale != NULL ? pageScale[pi] : 1;
+            next[pi] = (1 - d) / N + d * scale * next[pi];
+        }
+        diff = calculateDiff(*rank, *prevRank, g->nV);
+        (*iterations)++;
+    }
+
+    if (rc->stats) {
+        EdgeIndex dense = g->nE - t.sparse.nE;
+        double bitmapKB = (double)t.nTiles * TILE_SIZE * sizeof(uint64_t) 
+                        / 1024;
+        fprintf(statsStream(),
+                "tiles: %u dense tiles of %dx%d holding %llu links "
+                "(%.1f%%), %.1f KB of bitmaps for %.1f KB of link indices, "
+                "%llu sparse links, built in %.3fs\n", t.nTiles, TILE_SIZE, 
+                TILE_SIZE, (unsigned long long)dense, 
+                g->nE > 0 ? 100.0 * dense / g->nE : 0, bitmapKB, 
+                dense * sizeof(PageId) / 1024.0, 
+                (unsigned long long)t.sparse.nE, buildSeconds);
+    }
+    freeTiledGraph(&t);
+    freeLarge(share);
+    return diff;
+}
+
+// Finds the dense tiles and splits the links between them and the sparse 
+// rest. The first pass counts the tiles and the sparse links, and the 
+// second fills them in. count and tileOf are indexed by source block and 
+// reset after each row block through the list of blocks it touched.
+static void buildTiledGraph(RankGraph g, TiledGraph *t) {
+    PageId nBlocks = (g->nV + TILE_SIZE - 1) / TILE_SIZE;
+    t->nBlocks = nBlocks;
+    t->tileStart = allocArray(nBlocks + 1, sizeof(PageId));
+    uint32_t *count = allocArray(nBlocks + 1, sizeof(uint32_t));
+    PageId *tileOf = allocArray(nBlocks + 1, sizeof(PageId));
+    PageId *touched = allocArray(nBlocks + 1, sizeof(PageId));
+    for (PageId b = 0; b < nBlocks; b++) {
+        count[b] = 0;
+        tileOf[b] = PAGE_NONE;
+    }
+
+    for (int pass = 0; pass < 2; pass++) {
+        PageId tiles = 0;
+        EdgeIndex sparse = 0;
+        for (PageId row = 0; row < nBlocks; row++) {
+            PageId first = row * TILE_SIZE;
+            PageId last = first + TILE_SIZE < g->nV ? first + TILE_SIZE 
+                                                    : g->nV;
+            PageId nTouched = 0;
+            for (EdgeIndex e = g->inStart[first]; e < g->inStart[last]; e++) {
+                PageId col = g->inSrc[e] / TILE_SIZE;
+                if (count[col]++ == 0) touched[nTouched++] = col;
+            }
+            t->tileStart[row] = tiles;
+            for (PageId k = 0; k < nTouched; k++) {
+                PageId col = touched[k];
+                if (count[col] >= TILE_MIN_LINKS) {
+                    if (pass == 1) t->tileCol[tiles] = col;
+                    tileOf[col] = tiles++;
+                }
+            }
+            for (PageId pi = first; pi < last; pi++) {
+                if (pass == 1) t->sparse.inStart[pi] = sparse;
+                for (EdgeIndex e = g->inStart[pi]; e < g->inStart[pi + 1]; 
+                     e++) {
+                    PageId pj = g->inSrc[e];
+                    PageId tile = tileOf[pj / TILE_SIZE];
+                    if (tile == PAGE_NONE) {
+                        if (pass == 1) t->sparse.inSrc[sparse] = pj;
+                        sparse++;
+                    } else if (pass == 1) {
+                        t->bits[(size_t)tile * TILE_SIZE + pi - first] |= 
+                            (uint64_t)1 << (pj % TILE_SIZE);
+                    }
+                }
+            }
+            for (PageId k = 0; k < nTouched; k++) {
+                count[touched[k]] = 0;
+                tileOf[touched[k]] = PAGE_NONE;
+            }
+        }
+        t->tileStart[nBlocks] = tiles;
+        if (pass == 0) {
+            t->nTiles = tiles;
+            t->tileCol = allocArray((size_t)tiles + 1, sizeof(PageId));
+            t->bits = allocLarge((size_t)tiles * TILE_SIZE + 1, 
+                                 sizeof(uint64_t));
+            memset(t->bits, 0, 
+                   ((size_t)tiles * TILE_SIZE + 1) * sizeof(uint64_t));
+            t->sparse.nV = g->nV;
+            t->sparse.nE = sparse;
+            t->sparse.inStart = allocLarge(g->nV + 1, sizeof(EdgeIndex));
+            t->sparse.inSrc = allocLarge(sparse + PREFETCH_MAX_DISTANCE, 
+                                         sizeof(PageId));
+            t->sparse.inDegree = NULL;
+            t->sparse.outDegree = NULL;
+        } else {
+            t->sparse.inStart[g->nV] = sparse;
+            memset(&t->sparse.inSrc[sparse], 0, 
+                   PREFETCH_MAX_DISTANCE * sizeof(PageId));
+        }
+    }
+    free(count);
+    free(tileOf);
+    free(touched);
+}
+
+// Frees the tiles and the sparse links
+static void freeTiledGraph(TiledGraph *t) {
+    free(t->tileStart);
+    free(t->tileCol);
+    freeLarge(t->bits);
+    freeLarge(t->sparse.inStart);
+    freeLarge(t->sparse.inSrc);
+}
+
+// Orders pages by in-degree, highest first, then by page
+static int compareDegreeKeys(const void *a, const void *b) {
+    const DegreeKey *x = a;
+    const DegreeKey *y = b;
+    if (x->degree != y->degree) return x->degree > y->degree ? -1 : 1;
+    return (x->page > y->page) - (x->page < y->page);
+}
+
+// Splits the edge coefficients into per-page factors for solveFactored. 
+// Classic PageRank passes on prevRank[pj] / outDegree[pj], so it has no 
+// pageScale; pages without out-links pass nothing on, as in the weighted 
+// formula. For Weighted PageRank, Win is inDegree[pi] / inTotal[pj] and 
+// Wout is outDegree[pi] / outTotal[pj], so the coefficient is 
+// inDegree[pi] * outDegree[pi] times 1 / (inTotal[pj] * outTotal[pj]), 
+// using the adjusted out-degrees as setEdgeCoefficients does.
+static void setCoefficientFactors(RankGraph g, RankMode mode, 
+                                  double *pageScale, double *sourceScale) {
+    if (mode == MODE_CLASSIC) {
+        for (PageId p = 0; p < g->nV; p++) {
+            sourceScale[p] = g->outDegree[p] > 0 ? 1.0 / g->outDegree[p] : 0;
+        }
+        return;
+    }
+    double *inTotal = allocArray(g->nV, sizeof(double));
+    double *outTotal = allocArray(g->nV, sizeof(double));
+    memset(inTotal, 0, g->nV * sizeof(double));
+    memset(outTotal, 0, g->nV * sizeof(double));
+    for (PageId pi = 0; pi < g->nV; pi++) {
+        for (EdgeIndex e = g->inStart[pi]; e < g->inStart[pi + 1]; e++) {
+            PageId pj = g->inSrc[e];
+            inTotal[pj] += g->inDegree[pi];
+            outTotal[pj] += adjustedOutDegree(g, pi);
+        }
+    }
+    for (PageId p = 0; p < g->nV; p++) {
+        pageScale[p] = g->inDegree[p] * adjustedOutDegree(g, p);
+        // A page that links nowhere is never a source
+        double total = inTotal[p] * (outTotal[p] == 0 ? 0.5 : outTotal[p]);
+        sourceScale[p] = total > 0 ? 1 / total : 0;
+    }
+    free(inTotal);
+    free(outTotal);
+}
+
+// Sets y = (I - dA) x
+static void applyOperator(RankGraph g, const double *coef, const double *x, 
+                          double *y, double d, int distance) {
+    for (PageId pi = 0; pi < g->nV; pi++) {
+        double weight = distance > 0 
+                      ? getPageWeightPrefetch(g, coef, x, pi, distance) 
+                      : getPageWeight(g, coef, x, pi);
+        y[pi] = x[pi] - d * weight;
+    }
+}
+
+// Sets r = (1 - d) / N - (I - dA) x and returns |r|_1
+static double getResidual(RankGraph g, const double *coef, const double *x, 
+                          double *r, double d, int distance) {
+    double N = g->nV;
+    applyOperator(g, coef, x, r, d, distance);
+    double norm = 0;
+    for (PageId pi = 0; pi < g->nV; pi++) {
+        r[pi] = (1 - d) / N - r[pi];
+        norm += fabs(r[pi]);
+    }
+    return norm;
+}
+
+// Returns true if a BiCGSTAB inner product is too close to zero to divide 
+// by, given the product of the norms of the vectors in it
+static bool breaksDown(double dot, double scale) {
+    return !isfinite(dot) || fabs(dot) <= BICGSTAB_BREAKDOWN * scale;
+}
+
+// Returns the dot product of x and y
+static double dotProduct(const double *x, const double *y, PageId n) {
+    double sum = 0;
+    for (PageId i = 0; i < n; i++) {
+        sum += x[i] * y[i];
+    }
+    return sum;
+}
+
+// Finds the strongly connected components with an iterative version of 
+// Tarjan's algorithm that follows in-links. order lists the pages grouped 
+// by component, component c being order[compStart[c]] .. 
+// order[compStart[c + 1] - 1], and compOf maps each page to its component. 
+// Tarjan's algorithm finishes a component only after every component it 
+// can reach, and following in-links reaches the pages upstream, so the 
+// components come out upstream first. Within a component the pages are in 
+// page order. Returns the number of components.
+static PageId findComponents(RankGraph g, PageId *order, PageId *compStart, 
+                             PageId *compOf) {
+    PageId *index = allocArray(g->nV + 1, sizeof(PageId));
+    PageId *low = allocArray(g->nV + 1, sizeof(PageId));
+    PageId *stack = allocArray(g->nV + 1, sizeof(PageId));
+    PageId *callPage = allocArray(g->nV + 1, sizeof(PageId));
+    EdgeIndex *callEdge = allocArray(g->nV + 1, sizeof(EdgeIndex));
+    for (PageId p = 0; p < g->nV; p++) {
+        index[p] = PAGE_NONE;
+        compOf[p] = PAGE_NONE;
+    }
+
+    PageId nextIndex = 0;
+    PageId nComps = 0;
+    PageId nOrdered = 0;
+    PageId top = 0;
+    for (PageId root = 0; root < g->nV; root++) {
+        if (index[root] != PAGE_NONE) continue;
+        index[root] = low[root] = nextIndex++;
+        stack[top++] = root;
+        callPage[0] = root;
+        callEdge[0] = g->inStart[root];
+        PageId depth = 1;
+        while (depth > 0) {
+            PageId v = callPage[depth - 1];
+            if (callEdge[depth - 1] < g->inStart[v + 1]) {
+                PageId w = g->inSrc[callEdge[depth - 1]++];
+                if (index[w] == PAGE_NONE) {
+                    index[w] = low[w] = nextIndex++;
+                    stack[top++] = w;
+                    callPage[depth] = w;
+                    callEdge[depth] = g->inStart[w];
+                    depth++;
+                } else if (compOf[w] == PAGE_NONE && index[w] < low[v]) {
+                    // w is still on the stack
+                    low[v] = index[w];
+                }
+                continue;
+            }
+
+            // v is done. Pop its component if it is the root of one.
+            if (low[v] == index[v]) {
+                compStart[nComps] = nOrdered;
+                PageId w;
+                do {
+                    w = stack[--top];
+                    compOf[w] = nComps;
+                    order[nOrdered++] = w;
+                } while (w != v);
+                nComps++;
+            }
+            depth--;
+            if (depth > 0 && low[v] < low[callPage[depth - 1]]) {
+                low[callPage[depth - 1]] = low[v];
+            }
+        }
+    }
+    compStart[nComps] = nOrdered;
+
+    // Put each component's pages back in page order so iterating one reads 
+    // the rank arrays in order, as the power iteration does
+    for (PageId p = 0; p < g->nV; p++) {
+        order[compStart[compOf[p]]++] = p;
+    }
+    for (PageId c = nComps; c > 0; c--) {
+        compStart[c] = compStart[c - 1];
+    }
+    compStart[0] = 0;
+
+    free(index);
+    free(low);
+    free(stack);
+    free(callPage);
+    free(callEdge);
+    return nComps;
+}
+
+// Calculates the rank of pages first .. last - 1 from the previous ranks. 
+// With a non-zero distance the rank of the page linking in that many edges 
+// ahead is prefetched.
+static void updateRanks(RankGraph g, const double *coef, 
+                        const double *prevRank, double *rank, PageId first, 
+                        PageId last, double d, double N, int distance) {
+    if (distance == 0) {
+        for (PageId pi = first; pi < last; pi++) {
+            double weights = getPageWeight(g, coef, prevRank, pi);
+            rank[pi] = (1 - d) / N + d * weights;
+        }
+    } else {
+        for (PageId pi = first; pi < last; pi++) {
+            double weights = getPageWeightPrefetch(g, coef, prevRank, pi, 
+                                                   distance);
+            rank[pi] = (1 - d) / N + d * weights;
+        }
+    }
+}
+
+// Calculates the page weight. Without coefficients the ranks are summed as 
+// they are.
+static double getPageWeight(RankGraph g, const double *coef, 
+                            const double *prevRank, PageId pi) {
+    double totalWeight = 0;
+    if (coef == NULL) {
+        for (EdgeIndex e = g->inStart[pi]; e < g->inStart[pi + 1]; e++) {
+            totalWeight += prevRank[g->inSrc[e]];
+        }
+        return totalWeight;
+    }
+    for (EdgeIndex e = g->inStart[pi]; e < g->inStart[pi + 1]; e++) {
+        double weight = prevRank[g->inSrc[e]] * coef[e];
+        totalWeight += weight;
+    }
+    return totalWeight;
+}
+
+// Calculates the page weight, prefetching the source rank of the edge 
+// distance edges ahead. The padding after inSrc keeps this in bounds.
+static double getPageWeightPrefetch(RankGraph g, const double *coef, 
+                                    const double *prevRank, PageId pi, 
+                                    int distance) {
+    double totalWeight = 0;
+    if (coef == NULL) {
+        for (EdgeIndex e = g->inStart[pi]; e < g->inStart[pi + 1]; e++) {
+            __builtin_prefetch(&prevRank[g->inSrc[e + distance]]);
+            totalWeight += prevRank[g->inSrc[e]];
+        }
+        return totalWeight;
+    }
+    for (EdgeIndex e = g->inStart[pi]; e < g->inStart[pi + 1]; e++) {
+        __builtin_prefetch(&prevRank[g->inSrc[e + distance]]);
+        double weight = prevRank[g->inSrc[e]] * coef[e];
+        totalWeight += weight;
+    }
+    return totalWeight;
+}
+
+// Picks the prefetch distance by timing a sweep over the same sample of 
+// pages at each candidate distance and keeping the fastest. The sample is 
+// taken from the middle of the graph so it reads ranks from all over 
+// prevRank, like a full iteration. Gains of a few percent on the sample 
+// didn't carry over to full sweeps, so a distance is only kept if it takes 
+// under PREFETCH_MIN_GAIN of the time without prefetching.
+static int tunePrefetchDistance(RankGraph g, const double *coef, 
+                                const double *prevRank, double *rank, 
+                                double d, double N, bool stats) {
+    static const int distances[] = {0, 4, 8, 16, 32, 64, 128, 256};
+    int nDistances = sizeof(distances) / sizeof(distances[0]);
+    if (g->nE < PREFETCH_SAMPLE_EDGES) {
+        // Small graphs are cache resident and too quick to time reliably
+        return 0;
+    }
+
+    EdgeIndex middle = (g->nE - PREFETCH_SAMPLE_EDGES) / 2;
+    PageId first = 0;
+    while (first < g->nV && g->inStart[first] < middle) {
+        first++;
+    }
+    PageId last = first;
+    while (last < g->nV 
+           && g->inStart[last] - g->inStart[first] < PREFETCH_SAMPLE_EDGES) {
+        last++;
+    }
+
+    double best[sizeof(distances) / sizeof(distances[0])];
+    for (int k = 0; k < nDistances; k++) {
+        best[k] = INFINITY;
+    }
+    // Interleave the runs so a burst of noise doesn't favour one distance
+    for (int run = 0; run < PREFETCH_SAMPLE_RUNS; run++) {
+        for (int k = 0; k < nDistances; k++) {
+            double start = now();
+            updateRanks(g, coef, prevRank, rank, first, last, d, N, 
+                        distances[k]);
+            double seconds = now() - start;
+            if (seconds < best[k]) best[k] = seconds;
+        }
+    }
+
+    int chosen = 0;
+    for (int k = 1; k < nDistances; k++) {
+        if (best[k] < best[chosen]) chosen = k;
+    }
+    if (best[chosen] > best[0] * PREFETCH_MIN_GAIN) {
+        chosen = 0;
+    }
+    if (stats) {
+        double edges = g->inStart[last] - g->inStart[first];
+        fprintf(statsStream(),
+                "prefetch: distance %d, %.2f ns/edge (%.2f without)\n",
+                distances[chosen], best[chosen] * 1e9 / edges, 
+                best[0] * 1e9 / edges);
+    }
+    return distances[chosen];
+}
+
+// Calculates the diff for each iteration cycle
+static double calculateDiff(const double *rank, const double *prevRank, 
+                            PageId nV) {
+    double diff = 0;
+    for (PageId pi = 0; pi < nV; pi++) {
+        diff += fabs(rank[pi] - prevRank[pi]);
+    }
+    return diff;
+}
+
+// Splits the pages into nProcs contiguous ranges with about the same number 
+// of pages plus in-links each. Returns the nProcs + 1 range boundaries.
+static PageId *partitionPages(RankGraph g, int nProcs) {
+    PageId *bounds = allocArray(nProcs + 1, sizeof(PageId));
+    double total = (double)g->nV + g->nE;
+    PageId p = 0;
+    bounds[0] = 0;
+    for (int q = 1; q < nProcs; q++) {
+        double target = total * q / nProcs;
+        while (p < g->nV && (double)p + g->inStart[p] < target) {
+            p++;
+        }
+        bounds[q] = p;
+    }
+    bounds[nProcs] = g->nV;
+    return bounds;
+}
+
+// Calculates page ranks in rc->procs forked worker processes sharing one 
+// copy of the graph. The loader moves the in-links, edge coefficients and 
+// rank buffers into a POSIX shared memory segment. Each worker maps the 
+// graph read-only and updates its own range of pages in the shared rank 
+// buffers, with a process-shared barrier between iterations. The loader 
+// waits for the workers and copies out the ranks; g's in-links are freed 
+// once they are in the segment.
+static List calculatePageRankShared(List l, RankGraph g, 
+                                    const RankConfig *rc) {
+    int nProcs = rc->procs;
+    SharedRanks s;
+    createSharedRanks(&s, g, nProcs);
+    initialiseRank(s.rank[0], g->nV, g->nV);
+
+    // rank[1] is overwritten by the first iteration so calibration can use 
+    // it as scratch
+    int distance = rc->prefetch;
+    if (distance == PREFETCH_AUTO) {
+        distance = tunePrefetchDistance(&s.graph, s.coef, s.rank[0], 
+                                        s.rank[1], rc->d, g->nV, rc->stats);
+    }
+
+    // Flush so the workers don't inherit and repeat buffered output
+    fflush(stdout);
+    fflush(stderr);
+    double start = now();
+    pid_t *pids = allocArray(nProcs, sizeof(pid_t));
+    for (int w = 0; w < nProcs; w++) {
+        pids[w] = fork();
+        if (pids[w] == 0) {
+            sharedWorker(&s, w, rc, distance);
+            _exit(EXIT_SUCCESS);
+        }
+        if (pids[w] < 0) {
+            fprintf(stderr, "fork: %s\n", strerror(errno));
+            for (int k = 0; k < w; k++) {
+                kill(pids[k], SIGKILL);
+                waitpid(pids[k], NULL, 0);
+            }
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Only this call's workers are reaped, since batch jobs may be forking 
+    // their own. They are polled rather than waited on in turn because a 
+    // worker that dies would leave the others stuck at the barrier.
+    bool ok = true;
+    int running = nProcs;
+    while (running > 0) {
+        bool reaped = false;
+        for (int w = 0; w < nProcs; w++) {
+            if (pids[w] <= 0) continue;
+            int status;
+            pid_t pid = waitpid(pids[w], &status, WNOHANG);
+            if (pid < 0 && errno == EINTR) continue;
+            if (pid == 0) continue;
+            if (pid < 0) {
+                fprintf(stderr, "waitpid: %s\n", strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+            pids[w] = 0;
+            running--;
+            reaped = true;
+            if (ok && (!WIFEXITED(status) || WEXITSTATUS(status) != 0)) {
+                fprintf(stderr, "error: rank worker %d failed\n", (int)pid);
+                ok = false;
+                for (int k = 0; k < nProcs; k++) {
+                    if (pids[k] > 0) kill(pids[k], SIGKILL);
+                }
+            }
+        }
+        if (!reaped && running > 0) {
+            struct timespec pause = {0, 1000000};
+            nanosleep(&pause, NULL);
+        }
+    }
+    free(pids);
+    if (!ok) exit(EXIT_FAILURE);
+    double seconds = now() - start;
+
+    if (rc->stats) {
+        double minSeconds = s.seconds[0];
+        double maxSeconds = s.seconds[0];
+        for (int w = 1; w < nProcs; w++) {
+            if (s.seconds[w] < minSeconds) minSeconds = s.seconds[w];
+            if (s.seconds[w] > maxSeconds) maxSeconds = s.seconds[w];
+        }
+        int steps = s.header->iterations > 1 ? s.header->iterations - 1 : 1;
+        fprintf(statsStream(),
+                "iterate: %d iterations in %.3fs (%.3f ms each), "
+                "diff %g\n", s.header->iterations - 1, seconds, 
+                seconds * 1000 / steps, s.header->diff);
+        fprintf(statsStream(),
+                "shm: %d worker processes, %.1f MB segment (%.1f MB "
+                "read-only graph), compute %.3f-%.3fs\n", nProcs, 
+                s.size / 1048576.0, (s.size - s.graphOffset) / 1048576.0, 
+                minSeconds, maxSeconds);
+        printMemoryUsage(g, sizeof(double), 0);
+    }
+
+    const double *rank = s.rank[s.header->latest];
+    for (Node n = l->head; n != NULL; n = n->next) {
+        n->rank = rank[n->index];
+        n->outDegree = g->outDegree[n->index];
+        n->inDegree = g->inDegree[n->index];
+    }
+    pthread_barrier_destroy(&s.header->barrier);
+    munmap(s.base, s.size);
+    free(s.bounds);
+    return l;
+}
+
+// Creates the shared memory segment for --procs and moves g's in-links and 
+// their coefficients into it. Each of g's arrays is freed as soon as it has 
+// been copied and the coefficients are worked out in place, so no more than 
+// one array is held twice. The segment is unlinked straight away, so it 
+// goes when the last process unmaps it.
+static void createSharedRanks(SharedRanks *s, RankGraph g, int nProcs) {
+    static int segments = 0;
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    size_t diffOffset = (sizeof(SharedHeader) + 63) & ~(size_t)63;
+    size_t rankOffset = diffOffset + 3 * nProcs * sizeof(double);
+    rankOffset = (rankOffset + 63) & ~(size_t)63;
+    size_t graphOffset = rankOffset + 2 * (size_t)g->nV * sizeof(double);
+    graphOffset = (graphOffset + pageSize - 1) & ~(pageSize - 1);
+    size_t srcOffset = graphOffset + (g->nV + 1) * sizeof(EdgeIndex);
+    size_t coefOffset = srcOffset 
+                      + (g->nE + PREFETCH_MAX_DISTANCE) * sizeof(PageId);
+    coefOffset = (coefOffset + 7) & ~(size_t)7;
+    size_t size = coefOffset + (g->nE + 1) * sizeof(double);
+
+    char name[64];
+    snprintf(name, sizeof(name), "/pageRank.%d.%d", (int)getpid(), 
+             __atomic_fetch_add(&segments, 1, __ATOMIC_RELAXED));
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        fprintf(stderr, "shm_open: %s: %s\n", name, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    shm_unlink(name);
+    if (ftruncate(fd, size) != 0) {
+        fprintf(stderr, "ftruncate: %s: %s\n", name, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    char *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "mmap: %s: %s\n", name, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    s->header = (SharedHeader *)base;
+    s->base = base;
+    s->size = size;
+    s->graphOffset = graphOffset;
+    s->nProcs = nProcs;
+    s->bounds = partitionPages(g, nProcs);
+    s->diffs = (double *)(base + diffOffset);
+    s->seconds = s->diffs + 2 * nProcs;
+    s->rank[0] = (double *)(base + rankOffset);
+    s->rank[1] = s->rank[0] + g->nV;
+    s->graph = *g;
+    s->graph.inStart = (EdgeIndex *)(base + graphOffset);
+    s->graph.inSrc = (PageId *)(base + srcOffset);
+    s->coef = (double *)(base + coefOffset);
+
+    pthread_barrierattr_t attr;
+    pthread_barrierattr_init(&attr);
+    pthread_barrierattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_barrier_init(&s->header->barrier, &attr, nProcs);
+    pthread_barrierattr_destroy(&attr);
+
+    memcpy(s->graph.inStart, g->inStart, (g->nV + 1) * sizeof(EdgeIndex));
+    freeLarge(g->inStart);
+    g->inStart = NULL;
+    memcpy(s->graph.inSrc, g->inSrc, 
+           (g->nE + PREFETCH_MAX_DISTANCE) * sizeof(PageId));
+    freeLarge(g->inSrc);
+    g->inSrc = NULL;
+    fillEdgeCoefficients(&s->graph, 0, g->nV, s->coef);
+}
+
+// Runs worker w of a --procs iteration. Every worker sums the same diffs 
+// after the barrier, so they all stop after the same iteration. The diffs 
+// alternate between two slots so a worker that runs ahead can't overwrite 
+// one that a slower worker hasn't read yet.
+static void sharedWorker(SharedRanks *s, int w, const RankConfig *rc, 
+                         int distance) {
+    size_t graphBytes = s->size - s->graphOffset;
+    mprotect((char *)s->base + s->graphOffset, graphBytes, PROT_READ);
+    PageId first = s->bounds[w];
+    PageId last = s->bounds[w + 1];
+    double N = s->graph.nV;
+    double seconds = 0;
+
+    int latest = 0;
+    int iterations = 1;
+    double diff = rc->diffPR;
+    for (int i = 1; i < rc->maxIterations && diff >= rc->diffPR; i++) {
+        double *prevRank = s->rank[latest];
+        double *rank = s->rank[1 - latest];
+        double start = now();
+        updateRanks(&s->graph, s->coef, prevRank, rank, first, last, rc->d, 
+                    N, distance);
+        double *slot = s->diffs + (i & 1) * s->nProcs;
+        slot[w] = calculateDiff(rank + first, prevRank + first, 
+                                last - first);
+        seconds += now() - start;
+
+        pthread_barrier_wait(&s->header->barrier);
+        diff = 0;
+        for (int q = 0; q < s->nProcs; q++) {
+            diff += slot[q];
+        }
+        latest = 1 - latest;
+        iterations++;
+    }
+
+    s->seconds[w] = seconds;
+    if (w == 0) {
+        s->header->latest = latest;
+        s->header->iterations = iterations;
+        s->header->diff = diff;
+    }
+}
+
+#ifdef USE_MPI
+// Calculates page ranks with the pages split between the MPI processes. Each 
+// process updates its own pages, then sends the new ranks its neighbours 
+// need for their in-links and takes part in a sum of the diff. The first 
+// process gathers the final ranks into the url list.
+static List calculatePageRankMpi(List l, RankGraph g, const RankConfig *rc) {
+    double d = rc->d;
+    double N = g->nV;
+    PageId *bounds = partitionPages(g, mpiSize);
+    Partition *part = buildPartition(g, bounds);
+    RankGraph local = &part->local;
+    PageId nCols = local->nV + part->nGhosts;
+
+    double *rank = allocLarge(nCols, sizeof(double));
+    double *prevRank = allocLarge(nCols, sizeof(double));
+    initialiseRank(rank, nCols, N);
+    initialiseRank(prevRank, nCols, N);
+    GhostCodec codec;
+    initGhostCodec(&codec, part, rc->compress, N);
+
+    int distance = rc->prefetch;
+    if (distance == PREFETCH_AUTO) {
+        distance = tunePrefetchDistance(local, part->coef, rank, prevRank, d, 
+                                        N, false);
+    }
+
+    double start = now();
+    MpiStats ms = {0, 0, 0, 0, 0, 0, NULL, 0};
+    double diff = rc->diffPR;
+    if (rc->async) {
+        diff = iterateAsync(part, &codec, &rank, &prevRank, rc, N, distance, 
+                            &ms);
+    }
+    for (int i = 1; !rc->async && i < rc->maxIterations 
+                    && diff >= rc->diffPR; i++) {
+        double *tmp = prevRank;
+        prevRank = rank;
+        rank = tmp;
+
+        double computeStart = now();
+        updateRanks(local, part->coef, prevRank, rank, 0, local->nV, d, N, 
+                    distance);
+        double localDiff = calculateDiff(rank, prevRank, local->nV);
+        double exchangeStart = now();
+        ms.computeSeconds += exchangeStart - computeStart;
+
+        exchangeGhosts(part, &codec, rank, prevRank, &ms);
+        MPI_Allreduce(&localDiff, &diff, 1, MPI_DOUBLE, MPI_SUM, 
+                      MPI_COMM_WORLD);
+        ms.exchangeSeconds += now() - exchangeStart;
+        ms.sweeps++;
+    }
+    double seconds = now() - start;
+
+    // Report the spread of compute time and sweeps, which shows how well 
+    // balanced the partitions are
+    double maxValues[5];
+    double values[5] = {ms.computeSeconds, -ms.computeSeconds, 
+                        ms.exchangeSeconds, ms.sweeps, -ms.sweeps};
+    long long sums[6];
+    long long counts[6] = {part->nGhosts, ms.messages, ms.skipped, 
+                           ms.totalBytes, codec.values, codec.offered};
+    MPI_Reduce(values, maxValues, 5, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    MPI_Reduce(counts, sums, 6, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+
+    // Synchronous sweeps run in lockstep, so every process has the same 
+    // number of entries
+    long long *bytes = NULL;
+    if (!rc->async && ms.sweeps > 0) {
+        bytes = allocArray(ms.sweeps, sizeof(long long));
+        MPI_Reduce(ms.bytes, bytes, ms.sweeps, MPI_LONG_LONG, MPI_SUM, 0, 
+                   MPI_COMM_WORLD);
+    }
+    if (rc->stats) {
+        int steps = ms.sweeps > 0 ? ms.sweeps : 1;
+        fprintf(statsStream(),
+                "iterate: %d iterations in %.3fs (%.3f ms each), "
+                "diff %g\n", ms.sweeps, seconds, seconds * 1000 / steps, 
+                diff);
+        fprintf(statsStream(),
+                "mpi: %d processes, %lld ghost pages (%.1f KB sent "
+                "per iteration), compute %.3f-%.3fs, exchange up to %.3fs\n", 
+                mpiSize, sums[0], sums[0] * sizeof(double) / 1024.0, 
+                -maxValues[1], maxValues[0], maxValues[2]);
+        if (rc->async) {
+            fprintf(statsStream(), "async: %.0f-%.0f sweeps per process, %lld "
+                    "messages sent, %lld held back while the last was in "
+                    "flight\n", -maxValues[4], maxValues[3], sums[1], 
+                    sums[2]);
+        }
+        if (rc->compress >= 0) {
+            fprintf(statsStream(),
+                    "compress: %.1f KB sent in total, %lld of %lld "
+                    "ranks (%.1f%%), %.2f bytes per rank sent\n", 
+                    sums[3] / 1024.0, sums[4], sums[5], 
+                    sums[5] > 0 ? 100.0 * sums[4] / sums[5] : 0, 
+                    sums[4] > 0 ? (double)sums[3] / sums[4] : 0);
+        }
+        if (!rc->async) {
+            fprintf(statsStream(), "exchange: KB per iteration");
+            for (int i = 0; i < ms.sweeps; i++) {
+                fprintf(statsStream(), " %.1f", bytes[i] / 1024.0);
+            }
+            fprintf(statsStream(), "\n");
+        }
+        printMemoryUsage(g, sizeof(double), 0);
+    }
+    free(bytes);
+    free(ms.bytes);
+
+    // Collect every process's ranks in page order on the first process
+    int *pageCounts = allocArray(mpiSize, sizeof(int));
+    int *displs = allocArray(mpiSize, sizeof(int));
+    for (int q = 0; q < mpiSize; q++) {
+        pageCounts[q] = bounds[q + 1] - bounds[q];
+        displs[q] = bounds[q];
+    }
+    double *allRanks = mpiRank == 0 ? allocLarge(g->nV, sizeof(double)) 
+                                    : NULL;
+    MPI_Gatherv(rank, local->nV, MPI_DOUBLE, allRanks, pageCounts, displs, 
+                MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    if (mpiRank == 0) {
+        for (Node n = l->head; n != NULL; n = n->next) {
+            n->rank = allRanks[n->index];
+            n->outDegree = g->outDegree[n->index];
+            n->inDegree = g->inDegree[n->index];
+        }
+        freeLarge(allRanks);
+    }
+
+    free(pageCounts);
+    free(displs);
+    freeGhostCodec(&codec);
+    freeLarge(rank);
+    freeLarge(prevRank);
+    freePartition(part);
+    free(bounds);
+    return l;
+}
+
+// Extracts this process's partition from the full graph and agrees with the 
+// other processes which ranks each one sends every iteration
+static Partition *buildPartition(RankGraph g, const PageId *bounds) {
+    Partition *part = allocArray(1, sizeof(Partition));
+    PageId first = bounds[mpiRank];
+    PageId last = bounds[mpiRank + 1];
+    PageId nOwned = last - first;
+    part->first = first;
+    part->last = last;
+
+    // Find the pages on other processes that link to this one's
+    bool *needed = allocArray(g->nV, sizeof(bool));
+    memset(needed, 0, g->nV * sizeof(bool));
+    PageId nGhosts = 0;
+    for (EdgeIndex e = g->inStart[first]; e < g->inStart[last]; e++) {
+        PageId pj = g->inSrc[e];
+        if ((pj < first || pj >= last) && !needed[pj]) {
+            needed[pj] = true;
+            nGhosts++;
+        }
+    }
+
+    // Number the columns: owned pages, then ghosts in page order
+    PageId *col = allocArray(g->nV, sizeof(PageId));
+    part->nGhosts = nGhosts;
+    part->ghostPage = allocArray(nGhosts + 1, sizeof(PageId));
+    part->recvCounts = allocArray(mpiSize, sizeof(int));
+    part->recvDispls = allocArray(mpiSize, sizeof(int));
+    memset(part->recvCounts, 0, mpiSize * sizeof(int));
+    PageId nextGhost = 0;
+    int owner = 0;
+    for (PageId p = 0; p < g->nV; p++) {
+        if (p >= first && p < last) {
+            col[p] = p - first;
+        } else if (needed[p]) {
+            while (p >= bounds[owner + 1]) {
+                owner++;
+            }
+            part->recvCounts[owner]++;
+            col[p] = nOwned + nextGhost;
+            part->ghostPage[nextGhost++] = p;
+        }
+    }
+    free(needed);
+
+    // Copy the owned pages' in-links with their sources as columns
+    RankGraph local = &part->local;
+    EdgeIndex base = g->inStart[first];
+    local->nV = nOwned;
+    local->nE = g->inStart[last] - base;
+    local->inStart = allocLarge(nOwned + 1, sizeof(EdgeIndex));
+    local->inSrc = allocLarge(local->nE + PREFETCH_MAX_DISTANCE, 
+                              sizeof(PageId));
+    local->inDegree = NULL;
+    local->outDegree = NULL;
+    for (PageId pi = 0; pi <= nOwned; pi++) {
+        local->inStart[pi] = g->inStart[first + pi] - base;
+    }
+    for (EdgeIndex e = 0; e < local->nE; e++) {
+        local->inSrc[e] = col[g->inSrc[base + e]];
+    }
+    memset(&local->inSrc[local->nE], 0, 
+           PREFETCH_MAX_DISTANCE * sizeof(PageId));
+    free(col);
+    part->coef = setEdgeCoefficients(g, first, last);
+
+    // Tell each owner which of its pages to send here
+    part->sendCounts = allocArray(mpiSize, sizeof(int));
+    part->sendDispls = allocArray(mpiSize, sizeof(int));
+    MPI_Alltoall(part->recvCounts, 1, MPI_INT, part->sendCounts, 1, MPI_INT, 
+                 MPI_COMM_WORLD);
+    int nRecv = 0;
+    int nSend = 0;
+    for (int q = 0; q < mpiSize; q++) {
+        part->recvDispls[q] = nRecv;
+        part->sendDispls[q] = nSend;
+        nRecv += part->recvCounts[q];
+        nSend += part->sendCounts[q];
+    }
+    part->nSend = nSend;
+    part->sendCol = allocArray(nSend + 1, sizeof(PageId));
+    MPI_Alltoallv(part->ghostPage, part->recvCounts, part->recvDispls, 
+                  MPI_UINT32_T, part->sendCol, part->sendCounts, 
+                  part->sendDispls, MPI_UINT32_T, MPI_COMM_WORLD);
+    for (int k = 0; k < nSend; k++) {
+        part->sendCol[k] -= first;
+    }
+    return part;
+}
+
+// Sends the ranks other processes need and stores the ones received in the 
+// ghost columns of rank and prevRank. Compressed messages vary in length, 
+// so their lengths are swapped first.
+static void exchangeGhosts(const Partition *part, GhostCodec *codec, 
+                           double *rank, double *prevRank, MpiStats *ms) {
+    if (ms->sweeps == ms->bytesCapacity) {
+        ms->bytesCapacity = ms->bytesCapacity == 0 ? 64 
+                                                   : ms->bytesCapacity * 2;
+        ms->bytes = realloc(ms->bytes, 
+                            ms->bytesCapacity * sizeof(long long));
+        if (ms->bytes == NULL) {
+            fprintf(stderr, "error: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    ms->bytes[ms->sweeps] = 0;
+    for (int q = 0; q < mpiSize; q++) {
+        codec->sendLens[q] = encodeGhosts(codec, part, q, rank);
+        ms->bytes[ms->sweeps] += codec->sendLens[q];
+        ms->totalBytes += codec->sendLens[q];
+    }
+    if (codec->threshold >= 0) {
+        MPI_Alltoall(codec->sendLens, 1, MPI_INT, codec->recvLens, 1, 
+                     MPI_INT, MPI_COMM_WORLD);
+    } else {
+        for (int q = 0; q < mpiSize; q++) {
+            codec->recvLens[q] = part->recvCounts[q] * sizeof(double);
+        }
+    }
+    MPI_Alltoallv(codec->sendBytes, codec->sendLens, codec->sendOffsets, 
+                  MPI_BYTE, codec->recvBytes, codec->recvLens, 
+                  codec->recvOffsets, MPI_BYTE, MPI_COMM_WORLD);
+    for (int q = 0; q < mpiSize; q++) {
+        decodeGhosts(codec, part, q, codec->recvLens[q], rank, prevRank);
+    }
+}
+
+// Iterates without any global synchronisation. Each sweep uses whatever 
+// ghost ranks have arrived so far, and the new boundary ranks go to each 
+// neighbour whose previous message has been delivered; the others are 
+// skipped rather than waited for. Convergence is checked by a nonblocking 
+// allreduce of the local residuals that runs alongside the sweeps. When 
+// one completes with the sum under diffPR, and every process had heard 
+// from all of its neighbours since its previous report, all of them stop 
+// together because they see the same result. Returns the summed residual.
+static double iterateAsync(const Partition *part, GhostCodec *codec, 
+                           double **rank, double **prevRank, 
+                           const RankConfig *rc, double N, int distance, 
+                           MpiStats *ms) {
+    RankGraph local = (RankGraph)&part->local;
+    MPI_Request *sendReq = allocArray(mpiSize, sizeof(MPI_Request));
+    MPI_Request *recvReq = allocArray(mpiSize, sizeof(MPI_Request));
+    long long *sent = allocArray(mpiSize, sizeof(long long));
+    long long *received = allocArray(mpiSize, sizeof(long long));
+    bool *heard = allocArray(mpiSize, sizeof(bool));
+    for (int q = 0; q < mpiSize; q++) {
+        sendReq[q] = MPI_REQUEST_NULL;
+        recvReq[q] = MPI_REQUEST_NULL;
+        sent[q] = 0;
+        received[q] = 0;
+        heard[q] = false;
+        if (part->recvCounts[q] > 0) {
+            MPI_Irecv(codec->recvBytes + codec->recvOffsets[q], 
+                      codec->recvLens[q], MPI_BYTE, q, 0, MPI_COMM_WORLD, 
+                      &recvReq[q]);
+        }
+    }
+
+    // report and total hold the residual, the processes still waiting on a 
+    // neighbour and the processes that haven't hit maxIterations
+    double report[3];
+    double total[3] = {rc->diffPR, 0, 0};
+    MPI_Request check = MPI_REQUEST_NULL;
+    double localDiff = rc->diffPR;
+    bool done = false;
+    while (!done) {
+        double computeStart = now();
+        bool sweeping = ms->sweeps < rc->maxIterations - 1;
+        if (sweeping) {
+            double *tmp = *prevRank;
+            *prevRank = *rank;
+            *rank = tmp;
+            updateRanks(local, part->coef, *prevRank, *rank, 0, local->nV, 
+                        rc->d, N, distance);
+            localDiff = calculateDiff(*rank, *prevRank, local->nV);
+            ms->sweeps++;
+        }
+        double exchangeStart = now();
+        ms->computeSeconds += exchangeStart - computeStart;
+
+        for (int q = 0; q < mpiSize && sweeping; q++) {
+            if (part->sendCounts[q] == 0) continue;
+            int flag;
+            MPI_Test(&sendReq[q], &flag, MPI_STATUS_IGNORE);
+            if (!flag) {
+                ms->skipped++;
+                continue;
+            }
+            int len = encodeGhosts(codec, part, q, *rank);
+            MPI_Isend(codec->sendBytes + codec->sendOffsets[q], len, 
+                      MPI_BYTE, q, 0, MPI_COMM_WORLD, &sendReq[q]);
+            sent[q]++;
+            ms->messages++;
+            ms->totalBytes += len;
+        }
+
+        // Take every message that has arrived. Messages between two 
+        // processes stay in order, so the last one taken is the newest.
+        for (int q = 0; q < mpiSize; q++) {
+            if (part->recvCounts[q] == 0) continue;
+            int flag;
+            MPI_Status status;
+            MPI_Test(&recvReq[q], &flag, &status);
+            while (flag) {
+                int len;
+                MPI_Get_count(&status, MPI_BYTE, &len);
+                decodeGhosts(codec, part, q, len, *rank, *prevRank);
+                received[q]++;
+                heard[q] = true;
+                MPI_Irecv(codec->recvBytes + codec->recvOffsets[q], 
+                          codec->recvLens[q], MPI_BYTE, q, 0, MPI_COMM_WORLD, 
+                          &recvReq[q]);
+                MPI_Test(&recvReq[q], &flag, &status);
+            }
+        }
+
+        if (check == MPI_REQUEST_NULL) {
+            bool waiting = false;
+            for (int q = 0; q < mpiSize; q++) {
+                if (part->recvCounts[q] > 0 && !heard[q]) waiting = true;
+                heard[q] = false;
+            }
+            report[0] = localDiff;
+            report[1] = waiting;
+            report[2] = sweeping;
+            MPI_Iallreduce(report, total, 3, MPI_DOUBLE, MPI_SUM, 
+                           MPI_COMM_WORLD, &check);
+        } else {
+            int flag;
+            MPI_Test(&check, &flag, MPI_STATUS_IGNORE);
+            done = flag && ((total[0] < rc->diffPR && total[1] == 0) 
+                            || total[2] == 0);
+        }
+        ms->exchangeSeconds += now() - exchangeStart;
+    }
+
+    // Receive the messages still in flight so every send can complete
+    long long *expected = allocArray(mpiSize, sizeof(long long));
+    MPI_Alltoall(sent, 1, MPI_LONG_LONG, expected, 1, MPI_LONG_LONG, 
+                 MPI_COMM_WORLD);
+    for (int q = 0; q < mpiSize; q++) {
+        if (part->recvCounts[q] == 0) continue;
+        while (received[q] < expected[q]) {
+            MPI_Status status;
+            int len;
+            MPI_Wait(&recvReq[q], &status);
+            MPI_Get_count(&status, MPI_BYTE, &len);
+            decodeGhosts(codec, part, q, len, *rank, *prevRank);
+            received[q]++;
+            if (received[q] < expected[q]) {
+                MPI_Irecv(codec->recvBytes + codec->recvOffsets[q], 
+                          codec->recvLens[q], MPI_BYTE, q, 0, MPI_COMM_WORLD, 
+                          &recvReq[q]);
+            }
+        }
+        if (recvReq[q] != MPI_REQUEST_NULL) {
+            MPI_Cancel(&recvReq[q]);
+            MPI_Wait(&recvReq[q], MPI_STATUS_IGNORE);
+        }
+    }
+    MPI_Waitall(mpiSize, sendReq, MPI_STATUSES_IGNORE);
+
+    free(expected);
+    free(sendReq);
+    free(recvReq);
+    free(sent);
+    free(received);
+    free(heard);
+    return total[0];
+}
+
+// Sets up the message buffers. A negative threshold sends raw ranks. 
+// recvLens starts as the longest message each neighbour can send.
+static void initGhostCodec(GhostCodec *codec, const Partition *part, 
+                           double threshold, double N) {
+    int width = threshold >= 0 ? DELTA_MAX_BYTES : sizeof(double);
+    codec->threshold = threshold;
+    codec->offered = 0;
+    codec->values = 0;
+    codec->sentValue = allocArray(part->nSend + 1, sizeof(double));
+    initialiseRank(codec->sentValue, part->nSend, N);
+    codec->sendBytes = allocArray((size_t)part->nSend * width + 1, 1);
+    codec->recvBytes = allocArray((size_t)part->nGhosts * width + 1, 1);
+    codec->sendLens = allocArray(mpiSize, sizeof(int));
+    codec->recvLens = allocArray(mpiSize, sizeof(int));
+    codec->sendOffsets = allocArray(mpiSize, sizeof(int));
+    codec->recvOffsets = allocArray(mpiSize, sizeof(int));
+    for (int q = 0; q < mpiSize; q++) {
+        codec->sendOffsets[q] = part->sendDispls[q] * width;
+        codec->recvOffsets[q] = part->recvDispls[q] * width;
+        codec->recvLens[q] = part->recvCounts[q] * width;
+    }
+}
+
+// Writes the message for process q from the owned ranks in rank. Returns 
+// its length in bytes.
+static int encodeGhosts(GhostCodec *codec, const Partition *part, int q, 
+                        const double *rank) {
+    const PageId *cols = part->sendCol + part->sendDispls[q];
+    unsigned char *out = codec->sendBytes + codec->sendOffsets[q];
+    codec->offered += part->sendCounts[q];
+    if (codec->threshold < 0) {
+        double *values = (double *)out;
+        for (int k = 0; k < part->sendCounts[q]; k++) {
+            values[k] = rank[cols[k]];
+        }
+        codec->values += part->sendCounts[q];
+        return part->sendCounts[q] * sizeof(double);
+    }
+
+    double *sentValue = codec->sentValue + part->sendDispls[q];
+    unsigned char *p = out;
+    int next = 0;
+    for (int k = 0; k < part->sendCounts[q]; k++) {
+        double change = rank[cols[k]] - sentValue[k];
+        if (fabs(change) <= codec->threshold) continue;
+        float delta = change;
+        sentValue[k] += delta;
+        uint32_t gap = k - next;
+        while (gap >= 0x80) {
+            *p++ = gap | 0x80;
+            gap >>= 7;
+        }
+        *p++ = gap;
+        memcpy(p, &delta, sizeof(float));
+        p += sizeof(float);
+        next = k + 1;
+        codec->values++;
+    }
+    return p - out;
+}
+
+// Applies a message of len bytes from process q to the ghost columns of 
+// both rank buffers, so the next sweep sees it whichever way round they are
+static void decodeGhosts(const GhostCodec *codec, const Partition *part, 
+                         int q, int len, double *rank, double *prevRank) {
+    PageId base = part->local.nV + part->recvDispls[q];
+    const unsigned char *in = codec->recvBytes + codec->recvOffsets[q];
+    if (codec->threshold < 0) {
+        memcpy(rank + base, in, len);
+        memcpy(prevRank + base, in, len);
+        return;
+    }
+
+    const unsigned char *end = in + len;
+    PageId next = base;
+    while (in < end) {
+        uint32_t gap = 0;
+        int shift = 0;
+        while (*in & 0x80) {
+            gap |= (uint32_t)(*in++ & 0x7f) << shift;
+            shift += 7;
+        }
+        gap |= (uint32_t)*in++ << shift;
+        float delta;
+        memcpy(&delta, in, sizeof(float));
+        in += sizeof(float);
+        PageId col = next + gap;
+        rank[col] += delta;
+        prevRank[col] = rank[col];
+        next = col + 1;
+    }
+}
+
+// Frees the buffers made by initGhostCodec
+static void freeGhostCodec(GhostCodec *codec) {
+    free(codec->sentValue);
+    free(codec->sendBytes);
+    free(codec->recvBytes);
+    free(codec->sendLens);
+    free(codec->recvLens);
+    free(codec->sendOffsets);
+    free(codec->recvOffsets);
+}
+
+// Frees a partition made by buildPartition
+static void freePartition(Partition *part) {
+    freeLarge(part->local.inStart);
+    freeLarge(part->local.inSrc);
+    freeLarge(part->coef);
+    free(part->ghostPage);
+    free(part->recvCounts);
+    free(part->recvDispls);
+    free(part->sendCol);
+    free(part->sendCounts);
+    free(part->sendDispls);
+    free(part);
+}
+#endif
+
+// Reports the memory used by the graph and the iteration
+// given the bytes of coefficients stored per edge and any extra bytes kept 
+// per page
+static void printMemoryUsage(RankGraph g, size_t coefBytes, 
+                             size_t extraPageBytes) {
+    size_t edgeBytes = g->nE * (sizeof(PageId) + coefBytes);
+    size_t pageBytes = (g->nV + 1) * sizeof(EdgeIndex) 
+                     + g->nV * (2 * sizeof(uint32_t) + 2 * sizeof(double) 
+                                + extraPageBytes);
+    fprintf(statsStream(), "memory: %u pages, %llu edges, %.1f KB edge data "
+            "(%.0f bytes/edge), %.1f KB page data (%.0f bytes/page)\n", 
+            g->nV, (unsigned long long)g->nE, edgeBytes / 1024.0, 
+            g->nE > 0 ? (double)edgeBytes / g->nE : 0, pageBytes / 1024.0, 
+            g->nV > 0 ? (double)pageBytes / g->nV : 0);
+}
+
+// Allocates an array of n elements, exiting if there isn't enough memory
+static void *allocArray(size_t n, size_t size) {
+    void *p = malloc(n * size);
+    if (p == NULL) {
+        fprintf(stderr, "error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+// Allocates an array of n elements for the graph or ranks. With --hugepages 
+// arrays of 2MB or more are mapped on 2MB pages, from the hugetlb pool if 
+// asked for and it has room, otherwise as 2MB aligned transparent huge pages. 
+// On a batch worker the smallest kept block that fits is reused first. Must 
+// be freed with freeLarge.
+static void *allocLarge(size_t n, size_t size) {
+    size_t bytes = n * size;
+    char *kept = takeCachedBlock(bytes, false);
+    if (kept != NULL) return kept + LARGE_HEADER_SIZE;
+
+    size_t total = bytes + LARGE_HEADER_SIZE;
+    if (largeAllocMode == HUGEPAGES_OFF || total < HUGE_PAGE_SIZE) {
+        char *p = allocArray(total, 1);
+        ((LargeHeader *)p)->mapSize = 0;
+        ((LargeHeader *)p)->capacity = bytes;
+        return p + LARGE_HEADER_SIZE;
+    }
+
+    size_t mapSize = (total + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+    char *base = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if (largeAllocMode == HUGEPAGES_HUGETLB) {
+        base = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, 
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    }
+#endif
+    if (base == MAP_FAILED) {
+        // Map an extra 2MB so the block can start on a 2MB boundary
+        char *raw = mmap(NULL, mapSize + HUGE_PAGE_SIZE, 
+                         PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, 
+                         -1, 0);
+        if (raw == MAP_FAILED) {
+            fprintf(stderr, "error: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        uintptr_t aligned = ((uintptr_t)raw + HUGE_PAGE_SIZE - 1) 
+                          & ~(uintptr_t)(HUGE_PAGE_SIZE - 1);
+        base = (char *)aligned;
+        size_t head = base - raw;
+        if (head > 0) munmap(raw, head);
+        munmap(base + mapSize, HUGE_PAGE_SIZE - head);
+#ifdef MADV_HUGEPAGE
+        madvise(base, mapSize, MADV_HUGEPAGE);
+#endif
+    }
+    ((LargeHeader *)base)->mapSize = mapSize;
+    ((LargeHeader *)base)->capacity = mapSize - LARGE_HEADER_SIZE;
+    return base + LARGE_HEADER_SIZE;
+}
+
+// Grows an array from allocLarge to at least n elements, keeping its 
+// contents. Outside batch workers small blocks are grown with realloc. On a 
+// batch worker the array moves to the largest kept block, which is usually 
+// the one it grew into on the last job, so it stops growing. The block it 
+// outgrew is released rather than kept.
+static void *growLarge(void *p, size_t n, size_t size) {
+    char *base = NULL;
+    if (p != NULL) {
+        base = (char *)p - LARGE_HEADER_SIZE;
+        LargeHeader *h = (LargeHeader *)base;
+        if (h->capacity >= n * size) return p;
+        if (largeCache == NULL && h->mapSize == 0) {
+            base = realloc(base, n * size + LARGE_HEADER_SIZE);
+            if (base == NULL) {
+                fprintf(stderr, "error: out of memory\n");
+                exit(EXIT_FAILURE);
+            }
+            ((LargeHeader *)base)->capacity = n * size;
+            return base + LARGE_HEADER_SIZE;
+        }
+    }
+
+    char *kept = takeCachedBlock(n * size, true);
+    void *q = kept != NULL ? kept + LARGE_HEADER_SIZE : allocLarge(n, size);
+    if (p != NULL) {
+        memcpy(q, p, ((LargeHeader *)base)->capacity);
+        releaseLargeBlock(base);
+    }
+    return q;
+}
+
+// Takes a block of at least bytes from the batch worker's kept blocks: the 
+// smallest that fits, or the largest if asked. Returns NULL if none fits.
+static char *takeCachedBlock(size_t bytes, bool largest) {
+    if (largeCache == NULL) return NULL;
+    int best = -1;
+    for (int i = 0; i < largeCache->nBlocks; i++) {
+        size_t capacity = ((LargeHeader *)largeCache->blocks[i])->capacity;
+        if (capacity < bytes) continue;
+        if (best < 0) {
+            best = i;
+            continue;
+        }
+        size_t bestCapacity = 
+            ((LargeHeader *)largeCache->blocks[best])->capacity;
+        if (largest ? capacity > bestCapacity : capacity < bestCapacity) {
+            best = i;
+        }
+    }
+    if (best < 0) return NULL;
+    char *base = largeCache->blocks[best];
+    largeCache->blocks[best] = largeCache->blocks[--largeCache->nBlocks];
+    return base;
+}
+
+// Frees an array from allocLarge. On a batch worker the block is kept for 
+// reuse instead; when all slots are taken the smallest block is released.
+static void freeLarge(void *p) {
+    if (p == NULL) return;
+    char *base = (char *)p - LARGE_HEADER_SIZE;
+    if (largeCache == NULL) {
+        releaseLargeBlock(base);
+        return;
+    }
+    if (largeCache->nBlocks < LARGE_CACHE_SLOTS) {
+        largeCache->blocks[largeCache->nBlocks++] = base;
+        return;
+    }
+    int smallest = 0;
+    for (int i = 1; i < LARGE_CACHE_SLOTS; i++) {
+        if (((LargeHeader *)largeCache->blocks[i])->capacity 
+            < ((LargeHeader *)largeCache->blocks[smallest])->capacity) {
+            smallest = i;
+        }
+    }
+    if (((LargeHeader *)largeCache->blocks[smallest])->capacity 
+        < ((LargeHeader *)base)->capacity) {
+        char *evicted = largeCache->blocks[smallest];
+        largeCache->blocks[smallest] = base;
+        base = evicted;
+    }
+    releaseLargeBlock(base);
+}
+
+// Releases every block kept by a batch worker
+static void releaseLargeCache(LargeCache *c) {
+    for (int i = 0; i < c->nBlocks; i++) {
+        releaseLargeBlock(c->blocks[i]);
+    }
+    c->nBlocks = 0;
+}
+
+// Returns an allocLarge block, given by its header, to the system
+static void releaseLargeBlock(char *base) {
+    size_t mapSize = ((LargeHeader *)base)->mapSize;
+    if (mapSize == 0) {
+        free(base);
+    } else {
+        munmap(base, mapSize);
+    }
+}
+
+#ifdef HAVE_PERF_EVENTS
+
+// Starts counting a hardware event for this thread. Returns -1 if perf 
+// events aren't available.
+static int perfOpen(PerfCounter counter) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    switch (counter) {
+    case COUNT_DTLB_MISSES:
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_DTLB 
+                    | (PERF_COUNT_HW_CACHE_OP_READ << 8) 
+                    | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        break;
+    case COUNT_L1D_MISSES:
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_L1D 
+                    | (PERF_COUNT_HW_CACHE_OP_READ << 8) 
+                    | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        break;
+    case COUNT_LLC_MISSES:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        break;
+    }
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+// Returns the count of an event from perfOpen and closes it, or -1 if it 
+// isn't being counted
+static long long perfRead(int fd) {
+    if (fd < 0) return -1;
+    long long count;
+    if (read(fd, &count, sizeof(count)) != sizeof(count)) count = -1;
+    close(fd);
+    return count;
+}
+
+#else
+
+// perf events aren't available on this platform
+static int perfOpen(PerfCounter counter) {
+    (void)counter;
+    return -1;
+}
+
+static long long perfRead(int fd) {
+    (void)fd;
+    return -1;
+}
+
+#endif
+
+// Writes the ranked urls in the same format as ListPrint
+static void writeRanks(FILE *out, List l) {
+    for (Node n = l->head; n != NULL; n = n->next) {
+        fprintf(out, "%s %d %.7lf\n", n->url, (int)n->outDegree, n->rank);
+    }
+}
+
+//
+// Batch Mode
+//
+
+// Ranks every collection directory listed in the manifest (one per line) on 
+// the batch worker threads. Each directory is used as the input root and its 
+// ranks are written to BATCH_OUTPUT_FILE inside it. Returns the process exit 
+// status.
+static int runBatch(const Options *opt) {
+    FILE *fp = fopen(opt->manifest, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "fopen: %s\n", opt->manifest);
+        return EXIT_FAILURE;
+    }
+
+    BatchQueue q = {NULL, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER, opt};
+    int capacity = 0;
+    char *line = NULL;
+    size_t lineSize = 0;
+    ssize_t len;
+    while ((len = getline(&line, &lineSize, fp)) != -1) {
+        while (len > 0 && isspace((unsigned char)line[len - 1])) {
+            line[--len] = '\0';
+        }
+        // skip blank lines and comments
+        if (len == 0 || line[0] == '#') continue;
+
+        if (q.nDirs == capacity) {
+            capacity = capacity == 0 ? 64 : capacity * 2;
+            q.dirs = realloc(q.dirs, capacity * sizeof(char *));
+            if (q.dirs == NULL) {
+                fprintf(stderr, "error: out of memory\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        q.dirs[q.nDirs++] = strdup(line);
+    }
+    free(line);
+    fclose(fp);
+
+    int nThreads = opt->batchThreads;
+    if (nThreads > q.nDirs) nThreads = q.nDirs;
+    pthread_t *workers = malloc(nThreads * sizeof(pthread_t));
+    if (workers == NULL) {
+        fprintf(stderr, "error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < nThreads; i++) {
+        if (pthread_create(&workers[i], NULL, batchWorker, &q) != 0) {
+            fprintf(stderr, "error: pthread_create\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int i = 0; i < nThreads; i++) {
+        pthread_join(workers[i], NULL);
+    }
+
+    for (int i = 0; i < q.nDirs; i++) {
+        free(q.dirs[i]);
+    }
+    free(q.dirs);
+    free(workers);
+    pthread_mutex_destroy(&q.lock);
+    return q.failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Takes collections off the queue until it is empty. The worker's arena is 
+// reset between jobs so scratch memory is allocated once per thread, and its 
+// large arrays are kept so the next job only allocates the ones that grew.
+static void *batchWorker(void *arg) {
+    BatchQueue *q = arg;
+    Arena scratch = {NULL, NULL};
+    LargeCache cache = {{NULL}, 0};
+    largeCache = &cache;
+    while (true) {
+        pthread_mutex_lock(&q->lock);
+        int job = q->next++;
+        pthread_mutex_unlock(&q->lock);
+        if (job >= q->nDirs) break;
+
+        if (!rankCollection(q->opt, q->dirs[job], &scratch)) {
+            fprintf(stderr, "error: failed to rank %s\n", q->dirs[job]);
+            pthread_mutex_lock(&q->lock);
+            q->failed++;
+            pthread_mutex_unlock(&q->lock);
+        }
+        arenaReset(&scratch);
+    }
+    arenaFree(&scratch);
+    largeCache = NULL;
+    releaseLargeCache(&cache);
+    return NULL;
+}
+
+// Ranks the collection under root and writes its output file. Returns false 
+// on failure.
+static bool rankCollection(const Options *opt, const char *root, Arena *a) {
+    InputConfig in = opt->input;
+    in.root = root;
+
+    char *statsBuf = NULL;
+    size_t statsLen = 0;
+    if (opt->rank.stats) {
+        statsFile = open_memstream(&statsBuf, &statsLen);
+    }
+
+    bool ok = false;
+    List urlList = readCollectionFile(&in, a);
+    RankGraph urlGraph = NULL;
+    if (urlList != NULL) urlGraph = createGraph(urlList, &in, a);
+    if (urlGraph != NULL) {
+        urlList = calculatePageRank(urlList, urlGraph, &opt->rank);
+        ListSort(urlList);
+
+        char *path = joinPath(a, root, BATCH_OUTPUT_FILE, "");
+        FILE *out = fopen(path, "w");
+        if (out != NULL) {
+            writeRanks(out, urlList);
+            fclose(out);
+            ok = true;
+        } else {
+            fprintf(stderr, "fopen: %s\n", path);
+        }
+        freeRankGraph(urlGraph);
+    }
+    if (urlList != NULL) ListFree(urlList);
+
+    if (statsFile != NULL) {
+        fclose(statsFile);
+        statsFile = NULL;
+        printLabelledStats(root, statsBuf, statsLen);
+    }
+    free(statsBuf);
+    return ok;
+}
+
+// Writes each line of buf to stderr prefixed with "<label>: ". The lines of 
+// one job are written together so concurrent jobs don't interleave.
+static void printLabelledStats(const char *label, const char *buf, 
+                               size_t len) {
+    flockfile(stderr);
+    size_t start = 0;
+    while (start < len) {
+        const char *nl = memchr(buf + start, '\n', len - start);
+        size_t end = nl != NULL ? (size_t)(nl - buf) : len;
+        fprintf(stderr, "%s: %.*s\n", label, (int)(end - start), 
+                buf + start);
+        start = end + 1;
+    }
+    funlockfile(stderr);
+}
+
+// Returns the stream --stats lines should be written to on this thread
+static FILE *statsStream(void) {
+    return statsFile != NULL ? statsFile : stderr;
+}
+
+// Returns "<dir>/<name><ext>" allocated in the arena
+static char *joinPath(Arena *a, const char *dir, const char *name, 
+                      const char *ext) {
+    size_t len = strlen(dir) + 1 + strlen(name) + strlen(ext) + 1;
+    char *path = arenaAlloc(a, len);
+    snprintf(path, len, "%s/%s%s", dir, name, ext);
+    return path;
+}
+
+// Returns name if it is an absolute path, otherwise "<root>/<name>"
+static char *inputPath(Arena *a, const char *root, const char *name) {
+    if (name[0] == '/') return joinPath(a, "", name + 1, "");
+    return joinPath(a, root, name, "");
+}
+
+// Returns the current time in seconds
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//
+// Arena Allocator
+//
+
+// Returns size bytes from the arena, adding a new block if none has room
+static void *arenaAlloc(Arena *a, size_t size) {
+    // keep allocations 16 byte aligned
+    size = (size + 15) & ~(size_t)15;
+
+    // reuse blocks kept from before the last reset
+    while (a->curr != NULL && a->curr->used + size > a->curr->size) {
+        if (a->curr->next == NULL) break;
+        a->curr = a->curr->next;
+        a->curr->used = 0;
+    }
+
+    if (a->curr == NULL || a->curr->used + size > a->curr->size) {
+        size_t blockSize = ARENA_BLOCK_SIZE;
+        if (a->curr != NULL && a->curr->size * 2 > blockSize) {
+            blockSize = a->curr->size * 2;
+        }
+        if (size > blockSize) blockSize = size;
+
+        ArenaBlock *b = malloc(sizeof(ArenaBlock) + blockSize);
+        if (b == NULL) {
+            fprintf(stderr, "error: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        b->next = NULL;
+        b->size = blockSize;
+        b->used = 0;
+        if (a->curr == NULL) {
+            a->head = b;
+        } else {
+            a->curr->next = b;
+        }
+        a->curr = b;
+    }
+
+    void *p = a->curr->data + a->curr->used;
+    a->curr->used += size;
+    return p;
+}
+
+// Releases everything allocated from the arena but keeps the blocks
+static void arenaReset(Arena *a) {
+    a->curr = a->head;
+    if (a->curr != NULL) a->curr->used = 0;
+}
+
+// Frees all of the arena's blocks
+static void arenaFree(Arena *a) {
+    ArenaBlock *b = a->head;
+    while (b != NULL) {
+        ArenaBlock *next = b->next;
+        free(b);
+        b = next;
+    }
+    a->head = NULL;
+    a->curr = NULL;
+}
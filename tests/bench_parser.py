@@ -0,0 +1,96 @@
+#!/usr/bin/env python3
+# Parser throughput benchmark. Generates a collection with many outlinks per
+# page, ranks it with one iteration under each binary given and reports the
+# best wall time of several runs, plus the parse time and MB/s from --stats
+# for binaries that print them.
+# Binaries from before the url hash table look every outlink up in a list,
+# so keep --pages to a few thousand when timing one of them.
+#
+#   tests/bench_parser.py ./pageRank --pages 20000 --args=--io=uring
+
+import argparse
+import os
+import random
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+PARSE_STATS = re.compile(r"^parse: ([0-9.]+)s \(([0-9.]+) MB/s\)", re.M)
+
+
+def make_collection(root, n, links, seed):
+    rng = random.Random(seed)
+    urls = ["url%d" % i for i in range(n)]
+    with open(os.path.join(root, "collection.txt"), "w") as f:
+        f.write("\n".join(urls) + "\n")
+    size = 0
+    for u in urls:
+        body = " ".join(rng.choice(urls) for _ in range(links))
+        text = "#start Section-1\n\n%s\n\n#end Section-1\n" % body
+        with open(os.path.join(root, u + ".txt"), "w") as f:
+            f.write(text)
+        size += len(text)
+    return size
+
+
+def bench(binary, root, runs, extra):
+    # Binaries from before the options were added take no --stats
+    command = [binary, "0.85", "0.00001", "1"]
+    probe = subprocess.run(command + ["--stats"] + extra, cwd=root,
+                           capture_output=True)
+    if probe.returncode == 0:
+        command += ["--stats"]
+    command += extra
+
+    best = None
+    parse = None
+    for _ in range(runs):
+        start = time.perf_counter()
+        result = subprocess.run(command, cwd=root, capture_output=True,
+                                text=True)
+        seconds = time.perf_counter() - start
+        if result.returncode != 0:
+            sys.exit("%s failed: %s" % (binary, result.stderr.strip()))
+        match = PARSE_STATS.search(result.stderr)
+        if best is None or seconds < best:
+            best = seconds
+        if match and (parse is None or float(match.group(1)) < parse[0]):
+            parse = (float(match.group(1)), float(match.group(2)))
+    return best, parse
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Time the page parser of each binary")
+    parser.add_argument("binaries", nargs="+")
+    parser.add_argument("--pages", type=int, default=20000)
+    parser.add_argument("--links", type=int, default=50)
+    parser.add_argument("--runs", type=int, default=5)
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--args", default="",
+                        help="extra options for every binary, "
+                             "e.g. --args=--io=uring")
+    args = parser.parse_args()
+
+    root = tempfile.mkdtemp(prefix="bench_parser.")
+    try:
+        size = make_collection(root, args.pages, args.links, args.seed)
+        print("%d pages, %d links each, %.1f MB of page files"
+              % (args.pages, args.links, size / 1e6))
+        for binary in args.binaries:
+            best, parse = bench(os.path.abspath(binary), root, args.runs,
+                                args.args.split())
+            line = "%s: best of %d %.3fs" % (binary, args.runs, best)
+            if parse is not None:
+                line += ", parse %.3fs (%.1f MB/s)" % parse
+            print(line)
+    finally:
+        shutil.rmtree(root)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
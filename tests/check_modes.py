@@ -0,0 +1,227 @@
+#!/usr/bin/env python3
+# Regression check for the ranking modes. Generates a sample collection,
+# ranks it with the default power iteration over CSR, then ranks it again in
+# every other mode and fails if any page's rank differs by more than diffPR.
+# --mode=classic has different ranks, so it is checked against classic
+# PageRank worked out here. With --mpi the MPI build is checked as well.
+#
+#   tests/check_modes.py ./pageRank
+#   tests/check_modes.py ./pageRank --mpi ./pageRank.mpi --mpirun=mpirun
+
+import argparse
+import os
+import random
+import shlex
+import shutil
+import subprocess
+import sys
+import tempfile
+
+D = 0.85
+DIFF_PR = 1e-6
+MAX_ITERATIONS = 1000
+
+HOSTS = 8
+PAGES_PER_HOST = 80
+
+# The first DENSE pages link to most of each other, so --layout=tiles has
+# full tiles to keep as bitmaps
+DENSE = 64
+
+# The last TAIL pages form a chain with no cycles, for --prune to solve
+# directly
+TAIL = 40
+
+# Modes only in some builds, skipped when the binary doesn't know them
+OPTIONAL = {"--layout=buckets": "-DUSE_DEGREE_BUCKETS"}
+
+
+def make_collection(root, seed):
+    rng = random.Random(seed)
+    urls = ["http://h%d.example.com/p%d" % (i // PAGES_PER_HOST, i)
+            for i in range(HOSTS * PAGES_PER_HOST)]
+    n = len(urls)
+    links = {}
+    for i, url in enumerate(urls):
+        if i < DENSE:
+            targets = rng.sample(range(DENSE), 48)
+        elif i >= n - TAIL:
+            # Only linked to from earlier tail pages, so no cycle feeds them
+            targets = [rng.randrange(i + 1, n + 1) % n for _ in range(3)]
+        elif rng.random() < 0.1:
+            # Dangling pages
+            targets = []
+        else:
+            host = i // PAGES_PER_HOST * PAGES_PER_HOST
+            targets = [host + rng.randrange(PAGES_PER_HOST)
+                       for _ in range(rng.randint(1, 8))]
+            targets += [rng.randrange(n) for _ in range(rng.randint(0, 3))]
+            targets = [t for t in targets if t < n - TAIL]
+        links[url] = [urls[t] for t in targets] + ["http://unknown/x"]
+
+    with open(os.path.join(root, "collection.txt"), "w") as f:
+        f.write("\n".join(urls) + "\n")
+    for url, targets in links.items():
+        path = os.path.join(root, url + ".txt")
+        os.makedirs(os.path.dirname(path), exist_ok=True)
+        with open(path, "w") as f:
+            f.write("#start Section-1\n\n%s\n\n#end Section-1\n"
+                    % " ".join(targets))
+    return urls, links
+
+
+def classic_ranks(urls, links):
+    # Duplicate links, self loops and unknown urls are dropped, as in the
+    # graph the binary builds
+    index = {url: i for i, url in enumerate(urls)}
+    n = len(urls)
+    out = [sorted({index[t] for t in links[u] if t in index and t != u})
+           for u in urls]
+    rank = [1.0 / n] * n
+    for _ in range(1, MAX_ITERATIONS):
+        step = [(1 - D) / n] * n
+        for j in range(n):
+            for i in out[j]:
+                step[i] += D * rank[j] / len(out[j])
+        diff = sum(abs(a - b) for a, b in zip(step, rank))
+        rank = step
+        if diff < DIFF_PR:
+            break
+    return {url: rank[i] for i, url in enumerate(urls)}
+
+
+def read_ranks(text):
+    ranks = {}
+    for line in text.splitlines():
+        url, degree, rank = line.split()
+        ranks[url] = (int(degree), float(rank))
+    return ranks
+
+
+def run(command, root):
+    result = subprocess.run(command, cwd=root, capture_output=True,
+                            text=True, timeout=300)
+    if result.returncode != 0:
+        return None, result.stderr.strip()
+    return result.stdout, None
+
+
+def compare(expected, actual):
+    if expected.keys() != actual.keys():
+        return "different urls"
+    worst = 0.0
+    for url, (degree, rank) in expected.items():
+        if actual[url][0] != degree:
+            return "out-degree of %s differs" % url
+        worst = max(worst, abs(actual[url][1] - rank))
+    if worst > DIFF_PR:
+        return "ranks differ by up to %g" % worst
+    return None
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Check every ranking mode against the power iteration")
+    parser.add_argument("binary")
+    parser.add_argument("--mpi", help="binary built with -DUSE_MPI")
+    parser.add_argument("--mpirun", default="mpirun",
+                        help="launcher command for the MPI binary")
+    parser.add_argument("--np", type=int, default=3)
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+    binary = os.path.abspath(args.binary)
+
+    root = tempfile.mkdtemp(prefix="check_modes.")
+    failures = 0
+    try:
+        urls, links = make_collection(root, args.seed)
+        base = [str(D), str(DIFF_PR), str(MAX_ITERATIONS)]
+        text, error = run([binary] + base, root)
+        if text is None:
+            print("default: failed: %s" % error)
+            return 1
+        expected = read_ranks(text)
+
+        pack = os.path.join(root, "collection.pack")
+        table = os.path.join(root, "urls.table")
+        manifest = os.path.join(root, "manifest.txt")
+        with open(manifest, "w") as f:
+            f.write(root + "\n")
+        run([binary] + base + ["--pack=" + pack], root)
+
+        modes = [
+            ["--layout=sell"],
+            ["--layout=buckets"],
+            ["--layout=tiles"],
+            ["--solver=scc"],
+            ["--solver=bicgstab"],
+            ["--solver=gmres"],
+            ["--solver=chebyshev"],
+            ["--prune"],
+            ["--hosts=seed"],
+            ["--hosts=twolevel"],
+            ["--coefficients=computed"],
+            ["--procs=2"],
+            ["--prefetch=0"],
+            ["--prefetch=16"],
+            ["--hugepages=thp"],
+            ["--archive=" + pack],
+            ["--url-table=" + table],
+            ["--url-table=" + table],
+            ["--io=threads", "--ingest-threads=3", "--resolve-threads=2"],
+            ["--io=uring"],
+        ]
+        commands = [(" ".join(m), [binary] + base + m) for m in modes]
+        if args.mpi:
+            mpi = shlex.split(args.mpirun) + ["-np", str(args.np),
+                                              os.path.abspath(args.mpi)]
+            for m in [[], ["--async"], ["--compress=1e-10"],
+                      ["--archive=" + pack]]:
+                name = "mpi %s" % " ".join(m)
+                commands.append((name.strip(), mpi + base + m))
+
+        for name, command in commands:
+            text, error = run(command, root)
+            if (text is None and name in OPTIONAL
+                    and "unknown option" in error):
+                print("%s: skipped, needs a build with %s"
+                      % (name, OPTIONAL[name]))
+                continue
+            problem = error if text is None else compare(expected,
+                                                         read_ranks(text))
+            print("%s: %s" % (name, problem or "ok"))
+            failures += problem is not None
+
+        # Batch mode writes the ranks next to the collection
+        text, error = run([binary] + base + ["--batch=" + manifest], root)
+        if text is not None:
+            with open(os.path.join(root, "pageRankList.txt")) as f:
+                text = f.read()
+        problem = error if text is None else compare(expected,
+                                                     read_ranks(text))
+        print("--batch: %s" % (problem or "ok"))
+        failures += problem is not None
+
+        # Classic PageRank against the reference worked out here
+        text, error = run([binary] + base + ["--mode=classic"], root)
+        problem = error
+        if text is not None:
+            reference = classic_ranks(urls, links)
+            actual = read_ranks(text)
+            problem = compare({u: (actual[u][0], r)
+                               for u, r in reference.items()
+                               if u in actual}, actual)
+        print("--mode=classic: %s" % (problem or "ok"))
+        failures += problem is not None
+    finally:
+        shutil.rmtree(root)
+
+    if failures > 0:
+        print("%d modes failed" % failures)
+        return 1
+    print("all modes match")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,113 @@
+#!/usr/bin/env python3
+# Differential fuzz test for the page file tokenizer. Ranks randomized
+# collections with a reference binary built from the old fscanf parser and
+# with the binary under test, and fails on the first collection whose ranks
+# differ. The failing collection is kept for debugging.
+#
+# Build the reference the same way as pageRank, from the pageRank.c of the
+# commit before the tokenizer (git show 9e4fc7f^:pageRank.c), then run
+#   tests/fuzz_parser.py /tmp/pageRank.old ./pageRank
+# Options for the binary under test go in one --args=... argument.
+
+import argparse
+import os
+import random
+import shutil
+import subprocess
+import sys
+import tempfile
+
+# Everything fscanf's %s splits on, plus CRLF line ends
+SPACES = [" ", "\t", "\n", "\r\n", "  ", "\v", "\f", "\r"]
+
+# Tokens that look like the end marker but aren't, and the marker itself
+NEAR_END = ["#end", "#end2", "#endx", "#en", "end", "#END", "##end",
+            "#start", "#start Section-1"]
+
+# The old parser read the header line with fgets into 100 bytes, so longer
+# headers are only given in full to the binary under test
+OLD_HEADER_MAX = 98
+
+
+def make_collection(rng):
+    n = rng.randint(1, 20)
+    urls = ["url%d" % i for i in range(n)]
+    header = rng.choice(["#start Section-1", "", "#start", "  x y",
+                         "#end", "url0 url1"])
+    if rng.random() < 0.3:
+        header = "#start " + "x" * rng.randint(OLD_HEADER_MAX, 20000)
+    collection = "".join(u + rng.choice(SPACES) for u in urls)
+    if rng.random() < 0.2:
+        collection = collection.rstrip()
+
+    pages = {}
+    for u in urls:
+        tokens = [rng.choice(urls + NEAR_END + ["x", "url", "url1url"])
+                  for _ in range(rng.randint(0, 30))]
+        body = "".join(t + rng.choice(SPACES) for t in tokens)
+        if rng.random() < 0.2:
+            body = body.rstrip()
+        line_end = "\r\n" if rng.random() < 0.3 else "\n"
+        pages[u] = (header if rng.random() < 0.5 else "#start Section-1",
+                    line_end, body)
+    return collection, pages
+
+
+def write_collection(root, collection, pages, short_headers):
+    os.makedirs(root)
+    with open(os.path.join(root, "collection.txt"), "w", newline="") as f:
+        f.write(collection)
+    for url, (header, line_end, body) in pages.items():
+        if short_headers and len(header) > OLD_HEADER_MAX:
+            header = "#start"
+        path = os.path.join(root, url + ".txt")
+        with open(path, "w", newline="") as f:
+            f.write(header + line_end + body)
+
+
+def rank(binary, root, extra):
+    result = subprocess.run([binary, "0.85", "0.00001", "100"] + extra,
+                            cwd=root, capture_output=True, text=True,
+                            timeout=60)
+    return result.returncode, result.stdout
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Compare the ranks of the old and new page parsers")
+    parser.add_argument("old", help="binary built with the old parser")
+    parser.add_argument("new", help="binary under test")
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--runs", type=int, default=200)
+    parser.add_argument("--args", default="",
+                        help="extra options for the binary under test, "
+                             "e.g. '--io=threads --ingest-threads=4'")
+    args = parser.parse_args()
+    old = os.path.abspath(args.old)
+    new = os.path.abspath(args.new)
+
+    rng = random.Random(args.seed)
+    work = tempfile.mkdtemp(prefix="fuzz_parser.")
+    for run in range(args.runs):
+        collection, pages = make_collection(rng)
+        old_root = os.path.join(work, "old")
+        new_root = os.path.join(work, "new")
+        write_collection(old_root, collection, pages, True)
+        write_collection(new_root, collection, pages, False)
+
+        expected = rank(old, old_root, [])
+        actual = rank(new, new_root, args.args.split())
+        if expected != actual:
+            print("run %d (seed %d): ranks differ, collection kept in %s"
+                  % (run, args.seed, new_root))
+            return 1
+        shutil.rmtree(old_root)
+        shutil.rmtree(new_root)
+
+    shutil.rmtree(work)
+    print("%d collections ranked the same" % args.runs)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())